@@ -0,0 +1,136 @@
+/**
+ * @file NukiAdaptiveTimeout.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiAdaptiveTimeout.h"
+
+#define MAX_BACKOFF 4
+
+namespace Nuki {
+
+AdaptiveTimeoutTable::AdaptiveTimeoutTable(const uint32_t maxTimeoutMs)
+  : maxTimeoutMs(maxTimeoutMs) {
+}
+
+AdaptiveTimeoutTable::Entry* AdaptiveTimeoutTable::find(const Command command, const uint8_t variant,
+    const ResponsePhase phase, const bool create) {
+  for (uint8_t i = 0; i < NUKI_ADAPTIVE_TIMEOUT_SLOTS; i++) {
+    Entry& entry = entries[i];
+    if (!entry.used) {
+      if (!create) {
+        return nullptr;
+      }
+      entry.used = true;
+      entry.command = command;
+      entry.variant = variant;
+      entry.phase = phase;
+      return &entry;
+    }
+    if (entry.command == command && entry.variant == variant && entry.phase == phase) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+const AdaptiveTimeoutTable::Entry* AdaptiveTimeoutTable::find(const Command command, const uint8_t variant,
+    const ResponsePhase phase) const {
+  for (uint8_t i = 0; i < NUKI_ADAPTIVE_TIMEOUT_SLOTS && entries[i].used; i++) {
+    const Entry& entry = entries[i];
+    if (entry.command == command && entry.variant == variant && entry.phase == phase) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+uint32_t AdaptiveTimeoutTable::timeoutOf(const Entry& entry) const {
+  if (entry.samples < NUKI_ADAPTIVE_TIMEOUT_MIN_SAMPLES) {
+    return maxTimeoutMs;
+  }
+  uint32_t timeout = (entry.smoothedX8 >> 3) + entry.deviationX4;
+  timeout <<= entry.backoff;
+  if (timeout < NUKI_ADAPTIVE_TIMEOUT_MIN) {
+    timeout = NUKI_ADAPTIVE_TIMEOUT_MIN;
+  }
+  return timeout < maxTimeoutMs ? timeout : maxTimeoutMs;
+}
+
+uint32_t AdaptiveTimeoutTable::getTimeout(const Command command, const uint8_t variant, const ResponsePhase phase) const {
+  portENTER_CRITICAL(&mux);
+  const Entry* entry = find(command, variant, phase);
+  uint32_t timeout = entry != nullptr ? timeoutOf(*entry) : maxTimeoutMs;
+  portEXIT_CRITICAL(&mux);
+  return timeout;
+}
+
+void AdaptiveTimeoutTable::recordResponse(const Command command, const uint8_t variant, const ResponsePhase phase,
+    const uint32_t responseMs) {
+  portENTER_CRITICAL(&mux);
+  Entry* entry = find(command, variant, phase, true);
+  if (entry != nullptr) {
+    if (entry->samples == 0) {
+      entry->smoothedX8 = responseMs << 3;
+      entry->deviationX4 = responseMs << 1;
+    } else {
+      //smoothed += (sample - smoothed) / 8, deviation += (|sample - smoothed| - deviation) / 4
+      int32_t delta = (int32_t)responseMs - (int32_t)(entry->smoothedX8 >> 3);
+      entry->smoothedX8 += delta;
+      if (delta < 0) {
+        delta = -delta;
+      }
+      entry->deviationX4 += delta - (int32_t)(entry->deviationX4 >> 2);
+    }
+    if (entry->samples < UINT16_MAX) {
+      entry->samples++;
+    }
+    entry->backoff = 0;
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+void AdaptiveTimeoutTable::recordTimeout(const Command command, const uint8_t variant, const ResponsePhase phase) {
+  portENTER_CRITICAL(&mux);
+  Entry* entry = find(command, variant, phase, false);
+  if (entry != nullptr && entry->backoff < MAX_BACKOFF) {
+    entry->backoff++;
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+uint8_t AdaptiveTimeoutTable::getEstimates(TimeoutEstimate* estimates, const uint8_t maxCount) const {
+  uint8_t count = 0;
+  portENTER_CRITICAL(&mux);
+  for (uint8_t i = 0; i < NUKI_ADAPTIVE_TIMEOUT_SLOTS && entries[i].used && count < maxCount; i++) {
+    const Entry& entry = entries[i];
+    TimeoutEstimate& estimate = estimates[count++];
+    estimate.command = entry.command;
+    estimate.variant = entry.variant;
+    estimate.phase = entry.phase;
+    estimate.smoothedMs = entry.smoothedX8 >> 3;
+    estimate.deviationMs = entry.deviationX4 >> 2;
+    estimate.timeoutMs = timeoutOf(entry);
+    estimate.samples = entry.samples;
+    estimate.backoff = entry.backoff;
+  }
+  portEXIT_CRITICAL(&mux);
+  return count;
+}
+
+void AdaptiveTimeoutTable::reset() {
+  portENTER_CRITICAL(&mux);
+  for (uint8_t i = 0; i < NUKI_ADAPTIVE_TIMEOUT_SLOTS; i++) {
+    entries[i] = Entry();
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+} // namespace Nuki
@@ -0,0 +1,92 @@
+#pragma once
+/**
+ * @file NukiAdaptiveTimeout.h
+ * Per command response timeouts estimated from observed response times
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include "NukiDataTypes.h"
+#include "NukiConstants.h"
+
+#ifndef NUKI_ADAPTIVE_TIMEOUT_SLOTS
+#define NUKI_ADAPTIVE_TIMEOUT_SLOTS 16
+#endif
+#ifndef NUKI_ADAPTIVE_TIMEOUT_MIN
+#define NUKI_ADAPTIVE_TIMEOUT_MIN 500
+#endif
+#ifndef NUKI_ADAPTIVE_TIMEOUT_MIN_SAMPLES
+#define NUKI_ADAPTIVE_TIMEOUT_MIN_SAMPLES 5
+#endif
+
+namespace Nuki {
+
+/**
+ * @brief Awaited answer of a sent message: the first response (challenge, data, status accepted, error)
+ * or the status complete following accepted (motor movement of lock actions)
+ */
+enum class ResponsePhase : uint8_t {
+  Response  = 0,
+  Complete  = 1
+};
+
+struct TimeoutEstimate {
+  Command command;
+  uint8_t variant;                  //requested command for RequestData, action for lock actions, 0 otherwise
+  ResponsePhase phase;
+  uint32_t smoothedMs;              //EWMA of the response time
+  uint32_t deviationMs;             //EWMA of the deviation from smoothedMs
+  uint32_t timeoutMs;               //timeout currently applied
+  uint16_t samples;
+  uint8_t backoff;                  //consecutive timeouts, each doubles the timeout
+};
+
+/**
+ * @brief Response timeout estimation per command, variant and phase like TCP retransmission timeouts (RFC 6298):
+ * timeout = smoothed + 4 * deviation, clamped to [NUKI_ADAPTIVE_TIMEOUT_MIN, maxTimeoutMs], doubled on every
+ * consecutive timeout. Until NUKI_ADAPTIVE_TIMEOUT_MIN_SAMPLES responses are seen maxTimeoutMs applies.
+ * Up to NUKI_ADAPTIVE_TIMEOUT_SLOTS keys are tracked, others always get maxTimeoutMs.
+ */
+class AdaptiveTimeoutTable {
+  public:
+    explicit AdaptiveTimeoutTable(const uint32_t maxTimeoutMs);
+
+    uint32_t getTimeout(const Command command, const uint8_t variant, const ResponsePhase phase) const;
+    void recordResponse(const Command command, const uint8_t variant, const ResponsePhase phase, const uint32_t responseMs);
+    void recordTimeout(const Command command, const uint8_t variant, const ResponsePhase phase);
+
+    /**
+     * @return number of estimates written
+     */
+    uint8_t getEstimates(TimeoutEstimate* estimates, const uint8_t maxCount) const;
+    void reset();
+
+  private:
+    struct Entry {
+      bool used = false;
+      Command command = Command::Empty;
+      uint8_t variant = 0;
+      ResponsePhase phase = ResponsePhase::Response;
+      uint32_t smoothedX8 = 0;      //smoothed response time * 8
+      uint32_t deviationX4 = 0;     //deviation * 4
+      uint16_t samples = 0;
+      uint8_t backoff = 0;
+    };
+
+    Entry* find(const Command command, const uint8_t variant, const ResponsePhase phase, const bool create);
+    const Entry* find(const Command command, const uint8_t variant, const ResponsePhase phase) const;
+    uint32_t timeoutOf(const Entry& entry) const;
+
+    const uint32_t maxTimeoutMs;
+    Entry entries[NUKI_ADAPTIVE_TIMEOUT_SLOTS];
+    mutable portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+} // namespace Nuki
@@ -0,0 +1,87 @@
+/**
+ * @file NukiAdvertisementWindow.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiAdvertisementWindow.h"
+
+namespace Nuki {
+
+void AdvertisementWindow::recordAdvertisement(const uint32_t nowMs) {
+  portENTER_CRITICAL(&mux);
+  uint32_t gap = nowMs - lastMs;
+  if (sequence > 0 && gap < NUKI_ADVERT_MIN_INTERVAL) {
+    //same advertising event
+    portEXIT_CRITICAL(&mux);
+    return;
+  }
+
+  if (sequence > 0 && gap <= NUKI_ADVERT_MAX_INTERVAL) {
+    if (intervalX8 == 0) {
+      intervalX8 = gap * 8;
+    } else {
+      uint32_t interval = intervalX8 / 8;
+      //missed advertisements, rounded number of intervals in the gap
+      uint32_t intervals = (gap + interval / 2) / interval;
+      if (intervals > 1) {
+        gap /= intervals;
+      }
+      //smoothed += (gap - smoothed) / 8
+      intervalX8 = intervalX8 - interval + gap;
+    }
+  }
+  lastMs = nowMs;
+  sequence++;
+  portEXIT_CRITICAL(&mux);
+}
+
+uint32_t AdvertisementWindow::getIntervalMs() const {
+  portENTER_CRITICAL(&mux);
+  uint32_t interval = intervalX8 / 8;
+  portEXIT_CRITICAL(&mux);
+  return interval;
+}
+
+uint32_t AdvertisementWindow::msUntilNext(const uint32_t nowMs) const {
+  portENTER_CRITICAL(&mux);
+  uint32_t interval = intervalX8 / 8;
+  uint32_t sinceLast = nowMs - lastMs;
+  portEXIT_CRITICAL(&mux);
+
+  if (interval == 0) {
+    return 0;
+  }
+  uint32_t intoInterval = sinceLast % interval;
+  return intoInterval == 0 ? 0 : interval - intoInterval;
+}
+
+uint32_t AdvertisementWindow::getSequence() const {
+  portENTER_CRITICAL(&mux);
+  uint32_t value = sequence;
+  portEXIT_CRITICAL(&mux);
+  return value;
+}
+
+uint32_t AdvertisementWindow::getLastMs() const {
+  portENTER_CRITICAL(&mux);
+  uint32_t value = lastMs;
+  portEXIT_CRITICAL(&mux);
+  return value;
+}
+
+void AdvertisementWindow::reset() {
+  portENTER_CRITICAL(&mux);
+  lastMs = 0;
+  intervalX8 = 0;
+  sequence = 0;
+  portEXIT_CRITICAL(&mux);
+}
+
+} // namespace Nuki
@@ -0,0 +1,63 @@
+#pragma once
+/**
+ * @file NukiAdvertisementWindow.h
+ * Advertising interval of the lock learned from received advertisements
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+
+#ifndef NUKI_ADVERT_MIN_INTERVAL
+#define NUKI_ADVERT_MIN_INTERVAL 20
+#endif
+#ifndef NUKI_ADVERT_MAX_INTERVAL
+#define NUKI_ADVERT_MAX_INTERVAL 10000
+#endif
+
+namespace Nuki {
+
+/**
+ * @brief Estimates the advertising interval of the lock (which depends on its AdvertisingMode) as EWMA of the time
+ * between received advertisements and predicts the next advertising event.
+ *
+ * Advertisements closer than NUKI_ADVERT_MIN_INTERVAL belong to the same advertising event. Gaps of several
+ * intervals (advertisements missed by the scanner) are divided by the number of intervals they span, gaps longer
+ * than NUKI_ADVERT_MAX_INTERVAL (lock out of range, scanning disabled) are ignored.
+ */
+class AdvertisementWindow {
+  public:
+    void recordAdvertisement(const uint32_t nowMs);
+
+    /**
+     * @return estimated advertising interval, 0 until two advertisements were received
+     */
+    uint32_t getIntervalMs() const;
+
+    /**
+     * @return time until the next predicted advertisement, 0 if it is due or the interval is unknown
+     */
+    uint32_t msUntilNext(const uint32_t nowMs) const;
+
+    /**
+     * @return number of advertising events seen, changes when a new advertisement arrives
+     */
+    uint32_t getSequence() const;
+    uint32_t getLastMs() const;
+
+    void reset();
+
+  private:
+    uint32_t lastMs = 0;
+    uint32_t intervalX8 = 0;        //smoothed interval * 8
+    uint32_t sequence = 0;
+    mutable portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+} // namespace Nuki
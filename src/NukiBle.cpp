@@ -41,6 +41,9 @@ NukiBle::NukiBle(const std::string& deviceName,
     gdioUUID(gdioUUID),
     userDataUUID(userDataUUID),
     preferencesId(preferencedId) {
+  for (uint8_t i = 0; i < CONNECTION_PROFILE_COUNT; i++) {
+    connectionParameters[i].write(defaultConnectionParameters((ConnectionProfile)i));
+  }
 }
 
 NukiBle::~NukiBle() {
@@ -48,6 +51,22 @@ NukiBle::~NukiBle() {
     bleScanner->unsubscribe(this);
     bleScanner = nullptr;
   }
+  stopTasks();
+}
+
+void NukiBle::stopTasks() {
+  tasksStopping = true;
+  //a running refresh finishes its command and gives back the semaphore before it exits
+  while (stateRefreshRunning) {
+    vTaskDelay(1);
+  }
+  TaskHandle_t taskHandle = notificationTaskHandle;
+  if (taskHandle != nullptr) {
+    xTaskNotifyGive(taskHandle);
+    while (notificationTaskHandle != nullptr) {
+      vTaskDelay(1);
+    }
+  }
 }
 
 void NukiBle::initialize() {
@@ -60,9 +79,26 @@ void NukiBle::initialize() {
   pClient->setClientCallbacks(this);
   pClient->setConnectTimeout(1);
 
+  if (notificationTaskHandle == nullptr) {
+    TaskHandle_t taskHandle = nullptr;
+    if (xTaskCreatePinnedToCore(&NukiBle::notificationTask, "nukiNotify", NUKI_NOTIFICATION_TASK_STACK_SIZE, this,
+                                NUKI_NOTIFICATION_TASK_PRIORITY, &taskHandle, tskNO_AFFINITY) == pdPASS) {
+      notificationTaskHandle = taskHandle;
+    } else {
+      log_w("Unable to start notification task");
+    }
+  }
+
   isPaired = retrieveCredentials();
 }
 
+void NukiBle::enableScanning(const bool enable) {
+  //no scanner registered when the link is simulated
+  if (bleScanner != nullptr) {
+    bleScanner->enableScanning(enable);
+  }
+}
+
 void NukiBle::registerBleScanner(BleScanner::Publisher* bleScanner) {
   this->bleScanner = bleScanner;
   bleScanner->subscribe(this);
@@ -79,24 +115,31 @@ PairingResult NukiBle::pairNuki(AuthorizationIdType idType) {
     return PairingResult::Success;
   }
   PairingResult result = PairingResult::Pairing;
+  //attributes, advertising interval and config of a previously paired lock
+  invalidateAttributeCache();
+  advertisementWindow.reset();
+  resetConfigCache();
 
   if (pairingServiceAvailable && bleAddress != BLEAddress("")) {
     #ifdef DEBUG_NUKI_CONNECT
     log_d("Nuki in pairing mode found");
     #endif
-    if (connectBle(bleAddress)) {
+    if (connectBle(bleAddress, true)) {
       crypto_box_keypair(myPublicKey, myPrivateKey);
 
       PairingState nukiPairingState = PairingState::InitPairing;
       do {
         nukiPairingState = pairStateMachine(nukiPairingState);
-        delay(50);
+        nukiClock->sleepMs(50);
       } while ((nukiPairingState != PairingState::Success) && (nukiPairingState != PairingState::Timeout));
 
       if (nukiPairingState == PairingState::Success) {
         saveCredentials();
         result = PairingResult::Success;
-        lastHeartbeat = millis();
+        uint32_t now = nukiClock->nowMs();
+        advertisementState.update([now](AdvertisementState & state) {
+          state.lastHeartbeat = now;
+        });
       } else {
         result = PairingResult::Timeout;
       }
@@ -124,38 +167,93 @@ void NukiBle::unPairNuki() {
   #endif
 }
 
-bool NukiBle::connectBle(const BLEAddress bleAddress) {
+bool NukiBle::connectBle(const BLEAddress bleAddress, const bool pairing) {
   connecting = true;
-  bleScanner->enableScanning(false);
-  if (!pClient->isConnected()) {
+  connectGaveUpOnDeadline = false;
+  //a tap simulating the link replaces the BLE client, the connect logic below is the same
+  MessageTap* tap = getLinkTap();
+  enableScanning(false);
+  if (tap != nullptr ? !tap->isLinkConnected() : !pClient->isConnected()) {
     #ifdef DEBUG_NUKI_CONNECT
     log_d("connecting within: %s", pcTaskGetTaskName(xTaskGetCurrentTaskHandle()));
     #endif
 
+    ConnectionProfile profile = pairing ? ConnectionProfile::Default : ConnectionProfileScope::current();
+    ConnectionParameters parameters = connectionParameters[(uint8_t)profile].read();
+    if (tap == nullptr) {
+      pClient->setConnectionParams(parameters.minInterval, parameters.maxInterval, parameters.latency, parameters.supervisionTimeout);
+    }
+
+    RetryPolicy policy = retryPolicy.read();
     uint8_t connectRetry = 0;
-    while (connectRetry < 5) {
-      if (pClient->connect(bleAddress, true)) {
-        if (pClient->isConnected() && registerOnGdioChar() && registerOnUsdioChar()) {  //doublecheck if is connected otherwise registiring gdio crashes esp
-          bleScanner->enableScanning(true);
+    uint32_t attemptMs = 0;
+    while (connectRetry < policy.connectAttempts) {
+      //do not start an attempt that cannot complete within the deadline
+      if (DeadlineScope::remainingMs() <= attemptMs) {
+        log_w("BLE Connect aborted, deadline exceeded");
+        connectGaveUpOnDeadline = true;
+        break;
+      }
+      uint32_t attemptStart = nukiClock->nowMs();
+      bool advertSynced = false;
+      if (!pairing && connectOnAdvertisement) {
+        advertSynced = awaitAdvertisement();
+      }
+      if (timingActive) {
+        currentTiming.connectAttempts++;
+      }
+      metrics.connectAttempts++;
+      if (connectRetry > 0) {
+        metrics.connectRetries++;
+      }
+      if (tap != nullptr) {
+        if (tap->onConnectAttempt()) {
+          markCommandPhase(CommandPhase::Connected);
+          //simulated link, nothing to discover or negotiate
+          enterConnectionProfile(profile, 0, parameters.maxInterval);
+          enableScanning(true);
+          connecting = false;
+          return true;
+        }
+        log_w("BLE Connect failed, retrying");
+      } else if (pClient->connect(bleAddress, false)) {
+        //keep the discovered attributes, reconnects only resubscribe
+        markCommandPhase(CommandPhase::Connected);
+        if (pClient->isConnected() && subscribeCharacteristic(pairing)) {  //doublecheck if is connected otherwise registiring gdio crashes esp
+          markCommandPhase(CommandPhase::ServicesDiscovered);
+          NimBLEConnInfo connInfo = pClient->getConnInfo();
+          //NimBLE exchanges the application wide preferred MTU on connect, it is not changed per connection
+          if (connInfo.getMTU() < parameters.mtu) {
+            log_w("Negotiated MTU %d below %d of the %s profile", connInfo.getMTU(), parameters.mtu, connectionProfileName(profile));
+          }
+          enterConnectionProfile(profile, connInfo.getMTU(), connInfo.getConnInterval());
+          enableScanning(true);
           connecting = false;
           return true;
         } else {
-          log_w("BLE register on pairing or data Service/Char failed");
+          log_w("BLE register on %s Service/Char failed", pairing ? "pairing" : "data");
         }
       } else {
         pClient->disconnect();
         log_w("BLE Connect failed, retrying");
       }
+      //waiting for the next advertisement spaces the attempts
+      if (!advertSynced) {
+        nukiClock->sleepMs(policy.backoffMs(connectRetry, policy.connectBackoffMs));
+      }
       connectRetry++;
-      delay(10);
+      attemptMs = nukiClock->nowMs() - attemptStart;
     }
-  } else {
-    bleScanner->enableScanning(true);
+  } else if (tap != nullptr || subscribeCharacteristic(pairing)) {
+    enableScanning(true);
     connecting = false;
     return true;
+  } else {
+    log_w("BLE register on %s Service/Char failed", pairing ? "pairing" : "data");
   }
-  bleScanner->enableScanning(true);
+  enableScanning(true);
   connecting = false;
+  metrics.connectFailures++;
   log_w("BLE Connect failed");
   return false;
 }
@@ -165,13 +263,18 @@ void NukiBle::updateConnectionState() {
     lastStartTimeout = 0;
   }
 
-  if (lastStartTimeout != 0 && (millis() - lastStartTimeout > timeoutDuration)) {
+  if (lastStartTimeout != 0 && (nukiClock->nowMs() - lastStartTimeout > timeoutDuration)) {
     if (pClient && pClient->isConnected()) {
       pClient->disconnect();
       #ifdef DEBUG_NUKI_CONNECT
       log_d("disconnecting BLE on timeout");
       #endif
     }
+  } else if (!connecting && owner == SemaphoreTag::Free && pClient && pClient->isConnected()) {
+    uint32_t now = nukiClock->nowMs();
+    if (now - lastStartTimeout > NUKI_IDLE_PROFILE_DELAY && now - lastMessageMs > NUKI_IDLE_PROFILE_DELAY) {
+      useConnectionProfile(ConnectionProfile::Idle);
+    }
   }
 }
 
@@ -180,14 +283,20 @@ void NukiBle::setDisonnectTimeout(uint32_t timeoutMs) {
 }
 
 void NukiBle::extendDisonnectTimeout() {
-  lastStartTimeout = millis();
+  lastStartTimeout = nukiClock->nowMs();
 }
 
 void NukiBle::onResult(BLEAdvertisedDevice* advertisedDevice) {
   if (isPaired) {
     if (bleAddress == advertisedDevice->getAddress()) {
-      rssi = advertisedDevice->getRSSI();
-      lastReceivedBeaconTs = millis();
+      metrics.advertsProcessed++;
+      int rssi = advertisedDevice->getRSSI();
+      uint32_t now = nukiClock->nowMs();
+      advertisementState.update([rssi, now](AdvertisementState & state) {
+        state.rssi = rssi;
+        state.lastReceivedBeaconTs = now;
+      });
+      advertisementWindow.recordAdvertisement(now);
 
       std::string manufacturerData = advertisedDevice->getManufacturerData();
       uint8_t* manufacturerDataPtr = (uint8_t*)manufacturerData.data();
@@ -225,12 +334,7 @@ void NukiBle::onResult(BLEAdvertisedDevice* advertisedDevice) {
                 ENDIAN_CHANGE_U16(oBeacon.getMajor()), ENDIAN_CHANGE_U16(oBeacon.getMinor()),
                 oBeacon.getProximityUUID().toString().c_str(), oBeacon.getSignalPower());
           #endif
-          lastHeartbeat = millis();
-          if ((oBeacon.getSignalPower() & 0x01) > 0) {
-            if (eventHandler) {
-              eventHandler->notify(EventType::KeyTurnerStatusUpdated);
-            }
-          }
+          handleBeacon(rssi, (oBeacon.getSignalPower() & 0x01) > 0);
         }
       }
     }
@@ -249,7 +353,36 @@ void NukiBle::onResult(BLEAdvertisedDevice* advertisedDevice) {
   }
 }
 
+void NukiBle::handleBeacon(const int rssi, const bool stateChanged) {
+  uint32_t now = nukiClock->nowMs();
+  advertisementState.update([now](AdvertisementState & state) {
+    state.lastHeartbeat = now;
+  });
+  if (stateChanged) {
+    Event event;
+    event.type = EventType::KeyTurnerStatusUpdated;
+    event.rssi = rssi;
+    publishEvent(event);
+  }
+}
+
+void NukiBle::injectDisconnect() {
+  onDisconnect(pClient);
+}
+
+void NukiBle::injectAdvertisement(const int rssi, const bool stateChanged) {
+  metrics.advertsProcessed++;
+  uint32_t now = nukiClock->nowMs();
+  advertisementState.update([rssi, now](AdvertisementState & state) {
+    state.rssi = rssi;
+    state.lastReceivedBeaconTs = now;
+  });
+  advertisementWindow.recordAdvertisement(now);
+  handleBeacon(rssi, stateChanged);
+}
+
 Nuki::CmdResult NukiBle::retrieveKeypadEntries(const uint16_t offset, const uint16_t count) {
+  ConnectionProfileScope bulkTransfer(ConnectionProfile::Bulk);
   NukiLock::Action action;
   unsigned char payload[4] = {0};
   memcpy(payload, &offset, 2);
@@ -264,30 +397,30 @@ Nuki::CmdResult NukiBle::retrieveKeypadEntries(const uint16_t offset, const uint
   nrOfReceivedKeypadCodes = 0;
   keypadCodeCountReceived = false;
 
-  uint32_t timeNow = millis();
+  uint32_t timeNow = nukiClock->nowMs();
   Nuki::CmdResult result = executeAction(action);
 
   if (result == Nuki::CmdResult::Success) {
     //wait for return of Keypad Code Count (0x0044)
     while (!keypadCodeCountReceived) {
-      if (millis() - timeNow > GENERAL_TIMEOUT) {
+      if (nukiClock->nowMs() - timeNow > GENERAL_TIMEOUT) {
         log_w("Receive keypad count timeout");
         return CmdResult::TimeOut;
       }
-      delay(10);
+      nukiClock->sleepMs(10);
     }
     #ifdef DEBUG_NUKI_COMMAND
     log_d("Keypad code count %d", getKeypadEntryCount());
     #endif
 
     //wait for return of Keypad Codes (0x0045)
-    timeNow = millis();
+    timeNow = nukiClock->nowMs();
     while (nrOfReceivedKeypadCodes < getKeypadEntryCount()) {
-      if (millis() - timeNow > GENERAL_TIMEOUT) {
+      if (nukiClock->nowMs() - timeNow > GENERAL_TIMEOUT) {
         log_w("Receive keypadcodes timeout");
         return CmdResult::TimeOut;
       }
-      delay(10);
+      nukiClock->sleepMs(10);
     }
     #ifdef DEBUG_NUKI_COMMAND
     log_d("%d codes received", nrOfReceivedKeypadCodes);
@@ -365,6 +498,7 @@ CmdResult NukiBle::deleteKeypadEntry(uint16_t id) {
 }
 
 Nuki::CmdResult NukiBle::retrieveAuthorizationEntries(const uint16_t offset, const uint16_t count) {
+  ConnectionProfileScope bulkTransfer(ConnectionProfile::Bulk);
   NukiLock::Action action;
   unsigned char payload[4] = {0};
   memcpy(payload, &offset, 2);
@@ -450,6 +584,7 @@ Nuki::CmdResult NukiBle::setSecurityPin(const uint16_t newSecurityPin) {
   Nuki::CmdResult result = executeAction(action);
   if (result == Nuki::CmdResult::Success) {
     pinCode = newSecurityPin;
+    storedPincode = newSecurityPin;
     saveCredentials();
   }
   return result;
@@ -523,7 +658,11 @@ Nuki::CmdResult NukiBle::updateTime(TimeValue time) {
 }
 
 bool NukiBle::saveSecurityPincode(const uint16_t pinCode) {
-  return (preferences.putBytes(SECURITY_PINCODE_STORE_NAME, &pinCode, 2) == 2);
+  if (preferences.putBytes(SECURITY_PINCODE_STORE_NAME, &pinCode, 2) == 2) {
+    storedPincode = pinCode;
+    return true;
+  }
+  return false;
 }
 
 void NukiBle::saveCredentials() {
@@ -543,8 +682,10 @@ void NukiBle::saveCredentials() {
     //only store earlier retreived pin code if address is the same
     //otherwise it is a different/new lock
     preferences.putBytes(SECURITY_PINCODE_STORE_NAME, &pinCode, 2);
+    storedPincode = pinCode;
   } else {
     preferences.putBytes(SECURITY_PINCODE_STORE_NAME, &defaultPincode, 2);
+    storedPincode = defaultPincode;
   }
 
   if ((preferences.putBytes(BLE_ADDRESS_STORE_NAME, currentBleAddress, 6) == 6)
@@ -564,21 +705,13 @@ void NukiBle::saveCredentials() {
 }
 
 uint16_t NukiBle::getSecurityPincode() {
-
-  if (takeNukiBleSemaphore("retr pincode cred")) {
-    uint16_t storedPincode = 0000;
-    if ((preferences.getBytes(SECURITY_PINCODE_STORE_NAME, &storedPincode, 2) > 0)) {
-      giveNukiBleSemaphore();
-      return storedPincode;
-    }
-    giveNukiBleSemaphore();
-  }
-  return 0;
+  //kept in sync with the preferences on every read and write of the pincode
+  return storedPincode;
 }
 
 void NukiBle::getMacAddress(char* macAddress) {
   unsigned char buf[6];
-  if (takeNukiBleSemaphore("retr pincode cred")) {
+  if (takeNukiBleSemaphore(SemaphoreTag::RetrievePincodeCredentials)) {
     if ((preferences.getBytes(BLE_ADDRESS_STORE_NAME, buf, 6) > 0)) {
       BLEAddress address = BLEAddress(buf);
       sprintf(macAddress, "%d", address.toString().c_str());
@@ -592,13 +725,14 @@ bool NukiBle::retrieveCredentials() {
   //TODO check on empty (invalid) credentials?
   unsigned char buff[6];
 
-  if (takeNukiBleSemaphore("retr cred")) {
+  if (takeNukiBleSemaphore(SemaphoreTag::RetrieveCredentials)) {
     if ((preferences.getBytes(BLE_ADDRESS_STORE_NAME, buff, 6) > 0)
         && (preferences.getBytes(SECURITY_PINCODE_STORE_NAME, &pinCode, 2) > 0)
         && (preferences.getBytes(SECRET_KEY_STORE_NAME, secretKeyK, 32) > 0)
         && (preferences.getBytes(AUTH_ID_STORE_NAME, authorizationId, 4) > 0)
        ) {
       bleAddress = BLEAddress(buff);
+      storedPincode = pinCode;
 
       #ifdef DEBUG_NUKI_CONNECT
       log_d("[%s] Credentials retrieved :", deviceName.c_str());
@@ -630,15 +764,17 @@ bool NukiBle::retrieveCredentials() {
 }
 
 void NukiBle::deleteCredentials() {
-  if (takeNukiBleSemaphore("del cred")) {
+  if (takeNukiBleSemaphore(SemaphoreTag::DeleteCredentials)) {
     unsigned char emptySecretKeyK[32] = {0x00};
     unsigned char emptyAuthorizationId[4] = {0x00};
     preferences.putBytes(SECRET_KEY_STORE_NAME, emptySecretKeyK, 32);
     preferences.putBytes(AUTH_ID_STORE_NAME, emptyAuthorizationId, 4);
     // preferences.remove(SECRET_KEY_STORE_NAME);
     // preferences.remove(AUTH_ID_STORE_NAME);
+    invalidateAttributeCache();
     giveNukiBleSemaphore();
   }
+  resetConfigCache();
   #ifdef DEBUG_NUKI_CONNECT
   log_d("Credentials deleted");
   #endif
@@ -650,7 +786,7 @@ PairingState NukiBle::pairStateMachine(const PairingState nukiPairingState) {
       memset(challengeNonceK, 0, sizeof(challengeNonceK));
       memset(remotePublicKey, 0, sizeof(remotePublicKey));
       receivedStatus = 0xff;
-      timeNow = millis();
+      timeNow = nukiClock->nowMs();
       nukiPairingResultState = PairingState::ReqRemPubKey;
     }
     case PairingState::ReqRemPubKey: {
@@ -795,7 +931,7 @@ PairingState NukiBle::pairStateMachine(const PairingState nukiPairingState) {
     }
   }
 
-  if (millis() - timeNow > PAIRING_TIMEOUT) {
+  if (nukiClock->nowMs() - timeNow > PAIRING_TIMEOUT) {
     log_w("Pairing timeout");
     nukiPairingResultState = PairingState::Timeout;
   }
@@ -831,6 +967,23 @@ bool NukiBle::sendEncryptedMessage(Command commandIdentifier, const unsigned cha
   #endif
   printBuffer((byte*)plainDataWithCrc, sizeof(plainDataWithCrc), false, "Plain data with CRC: ");
 
+  MessageTap* tap = messageTap;
+  if (tap != nullptr) {
+    //a simulated link is connected through connectBle() with the retry policy of the device
+    if (tap->simulatesLink() && !connectBle(bleAddress)) {
+      log_w("Send encr msg failed due to unable to connect");
+      return false;
+    }
+    if (tap->onSendMessage(NotificationSource::Usdio, plainDataWithCrc, sizeof(plainDataWithCrc))) {
+      frameRecorder.record(FrameDirection::Tx, NotificationSource::Usdio, plainDataWithCrc, sizeof(plainDataWithCrc));
+      return true;
+    }
+    if (tap->simulatesLink()) {
+      log_w("Message not consumed by the simulated link, no BLE link to send it on");
+      return false;
+    }
+  }
+
   //compose additional data
   unsigned char additionalData[30] = {};
   generateNonce(sentNonce, sizeof(sentNonce));
@@ -855,8 +1008,9 @@ bool NukiBle::sendEncryptedMessage(Command commandIdentifier, const unsigned cha
     memcpy(&dataToSend[0], additionalData, sizeof(additionalData));
     memcpy(&dataToSend[30], plainDataEncr, sizeof(plainDataEncr));
 
-    if (connectBle(bleAddress)) {
+    if (connectBle(bleAddress) && pUsdioCharacteristic != nullptr) {
       printBuffer((byte*)dataToSend, sizeof(dataToSend), false, "Sending encrypted message");
+      frameRecorder.record(FrameDirection::Tx, NotificationSource::Usdio, plainDataWithCrc, sizeof(plainDataWithCrc));
       return pUsdioCharacteristic->writeValue((uint8_t*)dataToSend, sizeof(dataToSend), true);
     } else {
       log_w("Send encr msg failed due to unable to connect");
@@ -886,7 +1040,20 @@ bool NukiBle::sendPlainMessage(Command commandIdentifier, const unsigned char* p
   log_d("Command identifier: %02x, CRC: %04x", (uint32_t)commandIdentifier, dataCrc);
   #endif
 
-  if (connectBle(bleAddress)) {
+  MessageTap* tap = messageTap;
+  if (tap != nullptr) {
+    if (tap->onSendMessage(NotificationSource::Gdio, (uint8_t*)dataToSend, payloadLen + 4)) {
+      frameRecorder.record(FrameDirection::Tx, NotificationSource::Gdio, (uint8_t*)dataToSend, payloadLen + 4);
+      return true;
+    }
+    if (tap->simulatesLink()) {
+      log_w("Message not consumed by the simulated link, no BLE link to send it on");
+      return false;
+    }
+  }
+
+  if (connectBle(bleAddress, true) && pGdioCharacteristic != nullptr) {
+    frameRecorder.record(FrameDirection::Tx, NotificationSource::Gdio, (uint8_t*)dataToSend, payloadLen + 4);
     return pGdioCharacteristic->writeValue((uint8_t*)dataToSend, payloadLen + 4, true);
   } else {
     log_w("Send plain msg failed due to unable to connect");
@@ -906,10 +1073,11 @@ bool NukiBle::registerOnGdioChar() {
         using namespace std::placeholders;
         notify_callback callback = std::bind(&NukiBle::notifyCallback, this, _1, _2, _3, _4);
         pGdioCharacteristic->subscribe(false, callback, true); //false = indication, true = notification
+        gdioSubscribed = true;
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("GDIO characteristic registered");
         #endif
-        delay(100);
+        nukiClock->sleepMs(100);
         return true;
       } else {
         #ifdef DEBUG_NUKI_COMMUNICATION
@@ -941,10 +1109,11 @@ bool NukiBle::registerOnUsdioChar() {
         notify_callback callback = std::bind(&NukiBle::notifyCallback, this, _1, _2, _3, _4);
 
         pUsdioCharacteristic->subscribe(false, callback, true); //false = indication, true = notification
+        usdioSubscribed = true;
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("USDIO characteristic registered");
         #endif
-        delay(100);
+        nukiClock->sleepMs(100);
         return true;
       } else {
         #ifdef DEBUG_NUKI_COMMUNICATION
@@ -964,23 +1133,164 @@ bool NukiBle::registerOnUsdioChar() {
   return false;
 }
 
+bool NukiBle::awaitAdvertisement() {
+  uint32_t start = nukiClock->nowMs();
+  uint32_t sequence = advertisementWindow.getSequence();
+  if (sequence == 0 || start - advertisementWindow.getLastMs() > HEARTBEAT_TIMEOUT) {
+    //lock not seen lately, nothing to synchronize on
+    return false;
+  }
+
+  uint32_t interval = advertisementWindow.getIntervalMs();
+  uint32_t maxWaitMs = NUKI_ADVERT_SYNC_MAX_WAIT;
+  if (interval > 0 && 2 * interval + NUKI_ADVERT_SYNC_MARGIN < maxWaitMs) {
+    maxWaitMs = 2 * interval + NUKI_ADVERT_SYNC_MARGIN;
+  }
+  //leave at least half of the remaining deadline to the connect itself
+  uint32_t remainingMs = DeadlineScope::remainingMs();
+  if (remainingMs / 2 < maxWaitMs) {
+    maxWaitMs = remainingMs / 2;
+  }
+
+  enableScanning(true);
+  //sleep until shortly before the predicted advertisement, then poll for it
+  uint32_t untilNext = advertisementWindow.msUntilNext(start);
+  if (untilNext > NUKI_ADVERT_SYNC_MARGIN && untilNext - NUKI_ADVERT_SYNC_MARGIN < maxWaitMs) {
+    nukiClock->sleepMs(untilNext - NUKI_ADVERT_SYNC_MARGIN);
+  }
+  while (advertisementWindow.getSequence() == sequence && nukiClock->nowMs() - start < maxWaitMs) {
+    nukiClock->sleepMs(NUKI_ADVERT_SYNC_POLL);
+  }
+  enableScanning(false);
+
+  if (advertisementWindow.getSequence() != sequence) {
+    metrics.connectAdvertSyncs++;
+    return true;
+  }
+  #ifdef DEBUG_NUKI_CONNECT
+  log_d("No advertisement within %d ms, connecting anyway", maxWaitMs);
+  #endif
+  metrics.connectAdvertMisses++;
+  return false;
+}
+
+bool NukiBle::subscribeCharacteristic(const bool pairing) {
+  if (pairing) {
+    return gdioSubscribed || registerOnGdioChar();
+  }
+  if (usdioSubscribed || subscribeCachedAttributes()) {
+    return true;
+  }
+  if (registerOnUsdioChar()) {
+    attributesCached = true;
+    return true;
+  }
+  return false;
+}
+
+bool NukiBle::subscribeCachedAttributes() {
+  if (!attributesCached || pUsdioCharacteristic == nullptr) {
+    return false;
+  }
+
+  using namespace std::placeholders;
+  notify_callback callback = std::bind(&NukiBle::notifyCallback, this, _1, _2, _3, _4);
+  if (pUsdioCharacteristic->subscribe(false, callback, true)) {
+    usdioSubscribed = true;
+    #ifdef DEBUG_NUKI_COMMUNICATION
+    log_d("Cached USDIO characteristic subscribed");
+    #endif
+    return true;
+  }
+  log_w("Subscribing cached USDIO characteristic failed, discovering services");
+  invalidateAttributeCache();
+  return false;
+}
+
+void NukiBle::invalidateAttributeCache() {
+  if (attributesCached) {
+    pClient->deleteServices();
+  }
+  attributesCached = false;
+  pGdioCharacteristic = nullptr;
+  pUsdioCharacteristic = nullptr;
+  gdioSubscribed = false;
+  usdioSubscribed = false;
+}
+
 void NukiBle::notifyCallback(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* recData, size_t length, bool isNotify) {
+  //runs in the NimBLE host task, only copy the frame and hand it over to the notification task
+  if (length > NUKI_NOTIFICATION_FRAME_SIZE) {
+    notificationsOversized++;
+    return;
+  }
+
+  NotificationFrame* frame = notificationQueue.acquireWrite();
+  if (frame == nullptr) {
+    notificationsOverflowed++;
+    return;
+  }
+
+  frame->source = (pBLERemoteCharacteristic == pGdioCharacteristic) ? NotificationSource::Gdio : NotificationSource::Usdio;
+  frame->length = length;
+  memcpy(frame->data, recData, length);
+  notificationQueue.commitWrite();
+
+  uint32_t depth = notificationQueue.size();
+  if (depth > notificationQueueHighWaterMark) {
+    notificationQueueHighWaterMark = depth;
+  }
 
+  TaskHandle_t taskHandle = notificationTaskHandle;
+  if (taskHandle != nullptr) {
+    xTaskNotifyGive(taskHandle);
+  }
+}
+
+void NukiBle::notificationTask(void* pvParameters) {
+  NukiBle* nukiBle = (NukiBle*)pvParameters;
+  while (!nukiBle->tasksStopping) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!nukiBle->tasksStopping) {
+      nukiBle->processNotificationQueue();
+      nukiBle->processInjectedMessage();
+    }
+  }
+  nukiBle->notificationTaskHandle = nullptr;
+  vTaskDelete(NULL);
+}
+
+void NukiBle::processNotificationQueue() {
+  NotificationFrame* frame;
+  while ((frame = notificationQueue.peekRead()) != nullptr) {
+    processNotification(*frame);
+    notificationQueue.releaseRead();
+    notificationsProcessed++;
+  }
+}
+
+void NukiBle::processNotification(const NotificationFrame& frame) {
   #ifdef DEBUG_NUKI_COMMUNICATION
-  log_d(" Notify callback for characteristic: %s of length: %d", pBLERemoteCharacteristic->getUUID().toString().c_str(), length);
+  log_d(" Notification from %s of length: %d", frame.source == NotificationSource::Gdio ? "GDIO" : "USDIO", frame.length);
   #endif
+  FrameReassembler& reassembler = frame.source == NotificationSource::Gdio ? gdioReassembler : usdioReassembler;
+  ReassemblyResult reassembly = reassembler.append(frame.data, frame.length, nukiClock->nowMs());
+  if (reassembly == ReassemblyResult::Incomplete) {
+    return;
+  } else if (reassembly == ReassemblyResult::Invalid) {
+    log_w("Invalid %s message dropped", frame.source == NotificationSource::Gdio ? "GDIO" : "USDIO");
+    return;
+  }
+
+  //length of USDIO messages is validated by the reassembler
+  uint8_t* recData = (uint8_t*)reassembler.getFrame();
+  size_t length = reassembler.getLength();
   printBuffer((byte*)recData, length, false, "Received data");
 
-  if (pBLERemoteCharacteristic->getUUID() == gdioUUID) {
+  if (frame.source == NotificationSource::Gdio) {
     //handle not encrypted msg
-    uint16_t returnCode = ((uint16_t)recData[1] << 8) | recData[0];
-    crcCheckOke = crcValid(recData, length);
-    if (crcCheckOke) {
-      unsigned char plainData[200];
-      memcpy(plainData, &recData[2], length - 4);
-      handleReturnMessage((Command)returnCode, plainData, length - 4);
-    }
-  } else if (pBLERemoteCharacteristic->getUUID() == userDataUUID) {
+    handlePlaintextMessage(NotificationSource::Gdio, recData, length);
+  } else if (frame.source == NotificationSource::Usdio) {
     //handle encrypted msg
     unsigned char recNonce[crypto_secretbox_NONCEBYTES];
     unsigned char recAuthorizationId[4];
@@ -990,31 +1300,111 @@ void NukiBle::notifyCallback(BLERemoteCharacteristic* pBLERemoteCharacteristic,
     memcpy(recMsgLen, &recData[crypto_secretbox_NONCEBYTES + 4], 2);
     uint16_t encrMsgLen = 0;
     memcpy(&encrMsgLen, recMsgLen, 2);
-    unsigned char encrData[encrMsgLen];
-    memcpy(&encrData, &recData[crypto_secretbox_NONCEBYTES + 6], encrMsgLen);
+    unsigned char* encrData = &recData[crypto_secretbox_NONCEBYTES + 6];
 
     unsigned char decrData[encrMsgLen - crypto_secretbox_MACBYTES];
-    decode(decrData, encrData, encrMsgLen, recNonce, secretKeyK);
+    if (decode(decrData, encrData, encrMsgLen, recNonce, secretKeyK) < 0) {
+      //counted once, the garbage plaintext would fail the CRC check as well
+      metrics.decryptFailures++;
+      log_w("Decrypting message failed");
+      return;
+    }
 
     #ifdef DEBUG_NUKI_COMMUNICATION
     log_d("Received encrypted msg, len: %d", encrMsgLen);
     #endif
     printBuffer(recNonce, sizeof(recNonce), false, "received nonce");
     printBuffer(recAuthorizationId, sizeof(recAuthorizationId), false, "Received AuthorizationId");
-    printBuffer(encrData, sizeof(encrData), false, "Rec encrypted data");
+    printBuffer(encrData, encrMsgLen, false, "Rec encrypted data");
     printBuffer(decrData, sizeof(decrData), false, "Decrypted data");
 
-    crcCheckOke = crcValid(decrData, sizeof(decrData));
-    if (crcCheckOke) {
-      uint16_t returnCode = 0;
-      memcpy(&returnCode, &decrData[4], 2);
-      unsigned char payload[sizeof(decrData) - 8];
-      memcpy(&payload, &decrData[6], sizeof(payload));
-      handleReturnMessage((Command)returnCode, payload, sizeof(payload));
-    }
+    handlePlaintextMessage(NotificationSource::Usdio, decrData, sizeof(decrData));
   }
 }
 
+bool NukiBle::handlePlaintextMessage(const NotificationSource source, const uint8_t* plaintext, const uint16_t length) {
+  /*
+  GDIO:  # command identifier # payload # crc #
+  USDIO: # authorization identifier # command identifier # payload # crc #
+  */
+  uint8_t headerLen = source == NotificationSource::Usdio ? 6 : 2;
+  if (length < headerLen + 2 || length > NUKI_MAX_FRAME_SIZE) {
+    log_w("Invalid message length %d", length);
+    return false;
+  }
+
+  frameRecorder.record(FrameDirection::Rx, source, plaintext, length);
+  crcCheckOke = crcValid((uint8_t*)plaintext, length);
+  if (!crcCheckOke) {
+    metrics.crcFailures++;
+    return false;
+  }
+  lastMessageMs = nukiClock->nowMs();
+  messagesReceived++;
+
+  uint16_t returnCode = 0;
+  memcpy(&returnCode, &plaintext[headerLen - 2], 2);
+  //zero padded as handleReturnMessage copies fixed size structs
+  unsigned char payload[NUKI_MAX_FRAME_SIZE] = {0};
+  uint16_t payloadLen = length - headerLen - 2;
+  memcpy(payload, &plaintext[headerLen], payloadLen);
+  handleReturnMessage((Command)returnCode, payload, payloadLen);
+  return true;
+}
+
+bool NukiBle::injectReceivedMessage(const NotificationSource source, const uint8_t* plaintext, const uint16_t length,
+                                    uint32_t* processingUs) {
+  InjectedMessage message = {source, plaintext, length, false, 0};
+  TaskHandle_t taskHandle = notificationTaskHandle;
+  if (taskHandle == nullptr || taskHandle == xTaskGetCurrentTaskHandle()) {
+    handleInjectedMessage(message);
+  } else {
+    //received messages are only handled by the notification task, the caller waits until it is done
+    xSemaphoreTake(injectSemaphore, portMAX_DELAY);
+    pendingInjection = &message;
+    xTaskNotifyGive(taskHandle);
+    xSemaphoreTake(injectDoneSemaphore, portMAX_DELAY);
+    xSemaphoreGive(injectSemaphore);
+  }
+  if (processingUs != nullptr) {
+    *processingUs = message.processingUs;
+  }
+  return message.accepted;
+}
+
+void NukiBle::handleInjectedMessage(InjectedMessage& message) {
+  //handling time only, without the handoff to the notification task
+  int64_t startUs = esp_timer_get_time();
+  message.accepted = handlePlaintextMessage(message.source, message.plaintext, message.length);
+  message.processingUs = esp_timer_get_time() - startUs;
+}
+
+void NukiBle::processInjectedMessage() {
+  InjectedMessage* message = pendingInjection.exchange(nullptr);
+  if (message == nullptr) {
+    return;
+  }
+  handleInjectedMessage(*message);
+  xSemaphoreGive(injectDoneSemaphore);
+}
+
+void NukiBle::setClock(Clock* clock) {
+  nukiClock = clock;
+}
+
+Clock* NukiBle::getClock() const {
+  return nukiClock;
+}
+
+void NukiBle::setMessageTap(MessageTap* tap) {
+  messageTap = tap;
+}
+
+MessageTap* NukiBle::getLinkTap() const {
+  MessageTap* tap = messageTap;
+  return tap != nullptr && tap->simulatesLink() ? tap : nullptr;
+}
+
 void NukiBle::handleReturnMessage(Command returnCode, unsigned char* data, uint16_t dataLen) {
   switch (returnCode) {
     case Command::RequestData : {
@@ -1083,6 +1473,9 @@ void NukiBle::handleReturnMessage(Command returnCode, unsigned char* data, uint1
     case Command::ErrorReport : {
       log_e("Error: %02x for command: %02x:%02x", data[0], data[2], data[1]);
       memcpy(&errorCode, &data[0], sizeof(errorCode));
+      if (errorCode == 69) {
+        metrics.lockBusy++;
+      }
       logErrorCode(data[0]);
       break;
     }
@@ -1144,6 +1537,14 @@ void NukiBle::handleReturnMessage(Command returnCode, unsigned char* data, uint1
     }
     case Command::KeypadAction : {
       printBuffer((byte*)data, dataLen, false, "keypadAction");
+      if (dataLen >= 6) {
+        Event event;
+        event.type = EventType::KeypadAction;
+        event.keypadAction.source = data[0];
+        memcpy(&event.keypadAction.code, &data[1], 4);
+        event.keypadAction.action = data[5];
+        publishEvent(event);
+      }
       break;
     }
     default:
@@ -1155,49 +1556,321 @@ void NukiBle::onConnect(BLEClient*) {
   #ifdef DEBUG_NUKI_CONNECT
   log_d("BLE connected");
   #endif
+  Event event;
+  event.type = EventType::ConnectionUp;
+  publishEvent(event);
 };
 
 void NukiBle::onDisconnect(BLEClient*) {
   #ifdef DEBUG_NUKI_CONNECT
   log_d("BLE disconnected");
   #endif
+  gdioSubscribed = false;
+  usdioSubscribed = false;
+  leaveConnectionProfile();
+  Event event;
+  event.type = EventType::ConnectionDown;
+  publishEvent(event);
 };
 
 void NukiBle::setEventHandler(SmartlockEventHandler* handler) {
+  if (eventHandler != nullptr) {
+    eventBus.unsubscribe(eventHandler);
+  }
   eventHandler = handler;
+  if (handler != nullptr) {
+    eventBus.subscribe(handler, eventMask(EventType::KeyTurnerStatusUpdated));
+  }
+}
+
+bool NukiBle::subscribeEvents(SmartlockEventHandler* handler, const uint32_t eventMask) {
+  return eventBus.subscribe(handler, eventMask);
+}
+
+void NukiBle::unsubscribeEvents(SmartlockEventHandler* handler) {
+  eventBus.unsubscribe(handler);
+}
+
+uint8_t NukiBle::addStateWatch(SmartlockEventHandler* handler, const StateField field, StateWatchPredicate predicate) {
+  return eventBus.addWatch(handler, field, predicate);
+}
+
+void NukiBle::removeStateWatch(const uint8_t watchId) {
+  eventBus.removeWatch(watchId);
+}
+
+void NukiBle::publishEvent(Event event) {
+  event.timestamp = nukiClock->nowMs();
+  eventBus.publish(event);
+}
+
+void NukiBle::publishFieldChange(const StateField field, const int32_t previous, const int32_t current) {
+  if (previous != current && eventBus.hasSubscribers(EventType::StateFieldChanged)) {
+    Event event;
+    event.type = EventType::StateFieldChanged;
+    event.fieldChange.field = field;
+    event.fieldChange.previous = previous;
+    event.fieldChange.current = current;
+    publishEvent(event);
+  }
 }
 
 const bool NukiBle::isPairedWithLock() const {
   return isPaired;
 };
 
-bool NukiBle::takeNukiBleSemaphore(std::string taker) {
-  bool result = xSemaphoreTake(nukiBleSemaphore, NUKI_SEMAPHORE_TIMEOUT / portTICK_PERIOD_MS) == pdTRUE;
+bool NukiBle::takeNukiBleSemaphore(const SemaphoreTag tag) {
+  SemaphoreTag holder = owner;
+  uint32_t timeoutMs = NUKI_SEMAPHORE_TIMEOUT;
+  if (DeadlineScope::remainingMs() < timeoutMs) {
+    timeoutMs = DeadlineScope::remainingMs();
+  }
+  int64_t waitStartUs = esp_timer_get_time();
+  bool result = xSemaphoreTake(nukiBleSemaphore, timeoutMs / portTICK_PERIOD_MS) == pdTRUE;
+  int64_t nowUs = esp_timer_get_time();
+  metrics.recordSemaphoreWait(nowUs - waitStartUs, result);
+  semaphoreProfiler.recordWait(tag, holder, nowUs - waitStartUs, result);
 
   if (!result) {
-    log_d("%s FAILED to take Nuki semaphore. Owner %s", taker.c_str(), owner.c_str());
+    metrics.semaphoreTimeouts++;
+    log_d("%s FAILED to take Nuki semaphore. Owner %s", semaphoreTagName(tag), semaphoreTagName(owner));
   } else {
-    owner = taker;
+    owner = tag;
+    ownerSinceUs = nowUs;
   }
 
   return result;
 }
 
 void NukiBle::giveNukiBleSemaphore() {
-  owner = "free";
+  SemaphoreTag tag = owner.exchange(SemaphoreTag::Free);
+  if (tag != SemaphoreTag::Free) {
+    semaphoreProfiler.recordHold(tag, esp_timer_get_time() - ownerSinceUs);
+  }
   xSemaphoreGive(nukiBleSemaphore);
 }
 
+uint8_t NukiBle::timeoutVariant(const Command command, const unsigned char* payload, const uint8_t payloadLen) {
+  //response times differ per requested data and per lock action (e.g. unlatch takes longer than lock)
+  if ((command == Command::RequestData || command == Command::LockAction) && payloadLen > 0) {
+    return payload[0];
+  }
+  return 0;
+}
+
+void NukiBle::startResponseTimer(const Command command, const uint8_t variant, const ResponsePhase phase) {
+  timeNow = nukiClock->nowMs();
+  responseCommand = command;
+  responseVariant = variant;
+  responsePhase = phase;
+  responseTimeoutMs = adaptiveTimeoutsEnabled ? adaptiveTimeouts.getTimeout(command, variant, phase) : CMD_TIMEOUT;
+}
+
+bool NukiBle::responseTimedOut() {
+  if (nukiClock->nowMs() - timeNow > responseTimeoutMs) {
+    adaptiveTimeouts.recordTimeout(responseCommand, responseVariant, responsePhase);
+    return true;
+  }
+  return false;
+}
+
+void NukiBle::responseReceived() {
+  adaptiveTimeouts.recordResponse(responseCommand, responseVariant, responsePhase, nukiClock->nowMs() - timeNow);
+}
+
+void NukiBle::setAdaptiveTimeouts(const bool enable) {
+  adaptiveTimeoutsEnabled = enable;
+}
+
+uint8_t NukiBle::getTimeoutEstimates(TimeoutEstimate* estimates, const uint8_t maxCount) const {
+  return adaptiveTimeouts.getEstimates(estimates, maxCount);
+}
+
+void NukiBle::resetAdaptiveTimeouts() {
+  adaptiveTimeouts.reset();
+}
+
+void NukiBle::setRetryPolicy(const RetryPolicy& policy) {
+  retryPolicy.write(policy);
+}
+
+RetryPolicy NukiBle::getRetryPolicy() const {
+  return retryPolicy.read();
+}
+
+void NukiBle::setConnectOnAdvertisement(const bool enable) {
+  connectOnAdvertisement = enable;
+}
+
+uint32_t NukiBle::getAdvertisingIntervalMs() const {
+  return advertisementWindow.getIntervalMs();
+}
+
+void NukiBle::setConnectionParameters(const ConnectionProfile profile, const ConnectionParameters& parameters) {
+  connectionParameters[(uint8_t)profile].write(parameters);
+}
+
+ConnectionParameters NukiBle::getConnectionParameters(const ConnectionProfile profile) const {
+  return connectionParameters[(uint8_t)profile].read();
+}
+
+ConnectionProfile NukiBle::getConnectionProfile() const {
+  portENTER_CRITICAL(&profileMux);
+  ConnectionProfile profile = profileActive ? activeProfile : ConnectionProfile::Default;
+  portEXIT_CRITICAL(&profileMux);
+  return profile;
+}
+
+void NukiBle::useConnectionProfile(const ConnectionProfile profile) {
+  portENTER_CRITICAL(&profileMux);
+  bool inUse = profileActive && activeProfile == profile;
+  portEXIT_CRITICAL(&profileMux);
+  if (inUse) {
+    return;
+  }
+
+  ConnectionParameters parameters = connectionParameters[(uint8_t)profile].read();
+  MessageTap* tap = getLinkTap();
+  if (tap != nullptr) {
+    //simulated link, nothing to negotiate
+    if (tap->isLinkConnected()) {
+      enterConnectionProfile(profile, 0, parameters.maxInterval);
+    }
+  } else if (pClient != nullptr && pClient->isConnected()) {
+    pClient->updateConnParams(parameters.minInterval, parameters.maxInterval, parameters.latency, parameters.supervisionTimeout);
+    enterConnectionProfile(profile, pClient->getMTU(), parameters.maxInterval);
+  }
+  //not connected, connectBle() opens the connection with the profile of the calling task
+}
+
+void NukiBle::enterConnectionProfile(const ConnectionProfile profile, const uint16_t mtu, const uint16_t connInterval) {
+  leaveConnectionProfile();
+  portENTER_CRITICAL(&profileMux);
+  activeProfile = profile;
+  profileActive = true;
+  profileSinceMs = nukiClock->nowMs();
+  profileMessagesAtStart = messagesReceived;
+  portEXIT_CRITICAL(&profileMux);
+  metrics.recordProfileSession(profile, mtu, connInterval);
+  #ifdef DEBUG_NUKI_CONNECT
+  log_d("Connection profile %s, MTU %d, interval %d", connectionProfileName(profile), mtu, connInterval);
+  #endif
+}
+
+void NukiBle::leaveConnectionProfile() {
+  portENTER_CRITICAL(&profileMux);
+  if (!profileActive) {
+    portEXIT_CRITICAL(&profileMux);
+    return;
+  }
+  profileActive = false;
+  ConnectionProfile profile = activeProfile;
+  uint32_t messages = messagesReceived - profileMessagesAtStart;
+  uint32_t transferMs = messages > 0 ? lastMessageMs - profileSinceMs : 0;
+  portEXIT_CRITICAL(&profileMux);
+  metrics.recordProfileTransfer(profile, messages, transferMs);
+}
+
+void NukiBle::beginAttempt(RetryState& state) {
+  state.crcFailures = metrics.crcFailures + metrics.decryptFailures;
+  state.connectFailures = metrics.connectFailures;
+}
+
+bool NukiBle::retryAfterFailure(const Command command, const CommandType cmdType, const Nuki::CmdResult result,
+                                const uint16_t reachedPhases, const RetryPolicy& policy, RetryState& state) {
+  RetryReason reason;
+  if (result == Nuki::CmdResult::Lock_Busy) {
+    reason = RetryReason::LockBusy;
+  } else if (result != Nuki::CmdResult::Failed && result != Nuki::CmdResult::TimeOut) {
+    return false;
+  } else if (metrics.connectFailures != state.connectFailures) {
+    reason = RetryReason::ConnectFailure;
+  } else if (metrics.crcFailures + metrics.decryptFailures != state.crcFailures) {
+    reason = RetryReason::CrcFailure;
+  } else if (result == Nuki::CmdResult::TimeOut) {
+    reason = RetryReason::TimeOut;
+  } else {
+    //error report from the lock, retrying will not help
+    return false;
+  }
+
+  if (state.retries >= policy.retryBudget || state.retriesPerReason[(uint8_t)reason] >= policy.maxRetries[(uint8_t)reason]) {
+    return false;
+  }
+
+  if (!isIdempotent(command, cmdType)) {
+    //executed by the lock unless it failed before sending or was rejected as busy before being accepted
+    bool sent = reachedPhases & (1 << (uint8_t)CommandPhase::CommandSent);
+    bool accepted = reachedPhases & (1 << (uint8_t)CommandPhase::Accepted);
+    if (sent && (reason != RetryReason::LockBusy || accepted)) {
+      log_w("Command %04x not retried, it may have been executed", (uint16_t)command);
+      return false;
+    }
+  }
+
+  uint32_t backoff = policy.backoffMs(state.retries, policy.initialBackoffMs);
+  if (DeadlineScope::remainingMs() <= backoff) {
+    return false;
+  }
+
+  state.retries++;
+  state.retriesPerReason[(uint8_t)reason]++;
+  metrics.commandRetries++;
+  log_w("Command %04x failed (reason %d), retry %d in %d ms", (uint16_t)command, (uint8_t)reason, state.retries, backoff);
+  nukiClock->sleepMs(backoff);
+  return true;
+}
+
+Nuki::CmdResult NukiBle::applyDeadline(const Nuki::CmdResult result) {
+  if (result == Nuki::CmdResult::Success) {
+    return result;
+  }
+  if (DeadlineScope::expired() || connectGaveUpOnDeadline) {
+    log_w("Command aborted, deadline exceeded");
+    connectGaveUpOnDeadline = false;
+    nukiCommandState = CommandState::Idle;
+    lastMsgCodeReceived = Command::Empty;
+    return Nuki::CmdResult::DeadlineExceeded;
+  }
+  return result;
+}
+
+uint8_t NukiBle::getSemaphoreProfile(SemaphoreTagStats* stats, const uint8_t maxCount) const {
+  return semaphoreProfiler.getStats(stats, maxCount);
+}
+
+void NukiBle::dumpSemaphoreProfile(Print& out) const {
+  SemaphoreTagStats stats[SEMAPHORE_TAG_COUNT];
+  uint8_t count = getSemaphoreProfile(stats, SEMAPHORE_TAG_COUNT);
+  out.printf("%-18s %6s %6s %10s %8s %8s %10s %8s %8s %10s %6s\n", "taker", "taken", "t/o", "wait ms", "p99 ms", "max ms",
+             "hold ms", "p99 ms", "max ms", "blocks ms", "t/o by");
+  for (uint8_t i = 0; i < count; i++) {
+    const SemaphoreTagStats& tagStats = stats[i];
+    out.printf("%-18s %6u %6u %10.1f %8u %8.1f %10.1f %8u %8.1f %10.1f %6u\n", semaphoreTagName(tagStats.tag),
+               tagStats.acquisitions, tagStats.timeouts, tagStats.totalWaitUs / 1000.0, tagStats.wait.p99Ms,
+               tagStats.maxWaitUs / 1000.0, tagStats.totalHoldUs / 1000.0, tagStats.hold.p99Ms, tagStats.maxHoldUs / 1000.0,
+               tagStats.blockingUs / 1000.0, tagStats.timeoutsCaused);
+  }
+}
+
+void NukiBle::resetSemaphoreProfile() {
+  semaphoreProfiler.reset();
+}
+
+AdvertisementState NukiBle::getAdvertisementState() const {
+  return advertisementState.read();
+}
+
 int NukiBle::getRssi() const {
-  return rssi;
+  return advertisementState.read().rssi;
 }
 
 unsigned long  NukiBle::getLastReceivedBeaconTs() const {
-  return lastReceivedBeaconTs;
+  return advertisementState.read().lastReceivedBeaconTs;
 }
 
 uint32_t NukiBle::getLastHeartbeat() {
-  return lastHeartbeat;
+  return advertisementState.read().lastHeartbeat;
 }
 
 const BLEAddress NukiBle::getBleAddress() const
@@ -1205,4 +1878,258 @@ const BLEAddress NukiBle::getBleAddress() const
   return bleAddress;
 }
 
+NotificationQueueStats NukiBle::getNotificationQueueStats() const {
+  NotificationQueueStats stats;
+  stats.depth = notificationQueue.size();
+  stats.capacity = notificationQueue.capacity();
+  stats.highWaterMark = notificationQueueHighWaterMark;
+  stats.overflows = notificationsOverflowed;
+  stats.oversized = notificationsOversized;
+  stats.processed = notificationsProcessed;
+  ReassemblyStats gdio = gdioReassembler.getStats();
+  ReassemblyStats usdio = usdioReassembler.getStats();
+  stats.fragmented = gdio.fragmented + usdio.fragmented;
+  stats.invalidFrames = gdio.invalid + usdio.invalid;
+  stats.reassemblyTimeouts = gdio.timeouts + usdio.timeouts;
+  return stats;
+}
+
+uint32_t NukiBle::singleFlightKey(const Command command, const unsigned char* payload, const uint8_t payloadLen) {
+  //only pure reads without side effects on the device are joined, key 0 means execute on its own
+  switch (command) {
+    case Command::RequestData: {
+      if (payloadLen != 2) {
+        return 0;
+      }
+      uint16_t requested = 0;
+      memcpy(&requested, payload, sizeof(requested));
+      if (requested == (uint16_t)Command::KeyturnerStates || requested == (uint16_t)Command::BatteryReport) {
+        return ((uint32_t)command << 16) | requested;
+      }
+      return 0;
+    }
+    case Command::RequestConfig:
+    case Command::RequestAdvancedConfig:
+      return (uint32_t)command << 16;
+    default:
+      return 0;
+  }
+}
+
+NukiBle::SingleFlightTicket NukiBle::beginSingleFlight(const uint32_t key) {
+  SingleFlightTicket ticket;
+  if (key == 0) {
+    return ticket;
+  }
+
+  xSemaphoreTake(singleFlightSemaphore, portMAX_DELAY);
+  for (int8_t i = 0; i < NUKI_SINGLE_FLIGHT_SLOTS; i++) {
+    SingleFlightSlot& slot = singleFlightSlots[i];
+    if (slot.active && slot.key == key) {
+      slot.waiters++;
+      ticket.slot = i;
+      ticket.generation = slot.generation;
+      coalescedRequests++;
+      xSemaphoreGive(singleFlightSemaphore);
+      return ticket;
+    }
+  }
+  for (int8_t i = 0; i < NUKI_SINGLE_FLIGHT_SLOTS; i++) {
+    SingleFlightSlot& slot = singleFlightSlots[i];
+    //a slot is only reused when all waiters of the previous flight have picked up their result
+    if (!slot.active && slot.waiters == 0) {
+      slot.key = key;
+      slot.active = true;
+      ticket.slot = i;
+      ticket.leader = true;
+      ticket.generation = slot.generation;
+      break;
+    }
+  }
+  xSemaphoreGive(singleFlightSemaphore);
+  return ticket;
+}
+
+void NukiBle::endSingleFlight(const SingleFlightTicket& ticket, const Nuki::CmdResult result) {
+  if (ticket.slot < 0 || !ticket.leader) {
+    return;
+  }
+  xSemaphoreTake(singleFlightSemaphore, portMAX_DELAY);
+  SingleFlightSlot& slot = singleFlightSlots[ticket.slot];
+  slot.result = result;
+  slot.generation++;
+  slot.active = false;
+  xSemaphoreGive(singleFlightSemaphore);
+}
+
+Nuki::CmdResult NukiBle::awaitSingleFlight(const SingleFlightTicket& ticket) {
+  uint32_t start = nukiClock->nowMs();
+  uint8_t retryBudget = retryPolicy.read().retryBudget;
+  SingleFlightSlot& slot = singleFlightSlots[ticket.slot];
+  while (1) {
+    xSemaphoreTake(singleFlightSemaphore, portMAX_DELAY);
+    if (slot.generation != ticket.generation) {
+      Nuki::CmdResult result = slot.result;
+      slot.waiters--;
+      xSemaphoreGive(singleFlightSemaphore);
+      return result;
+    }
+    if (nukiClock->nowMs() - start > (NUKI_SEMAPHORE_TIMEOUT + 2 * CMD_TIMEOUT) * (1 + retryBudget)) {
+      slot.waiters--;
+      xSemaphoreGive(singleFlightSemaphore);
+      log_w("Timeout waiting for coalesced request");
+      return Nuki::CmdResult::TimeOut;
+    }
+    if (DeadlineScope::expired()) {
+      slot.waiters--;
+      xSemaphoreGive(singleFlightSemaphore);
+      return Nuki::CmdResult::DeadlineExceeded;
+    }
+    xSemaphoreGive(singleFlightSemaphore);
+    esp_task_wdt_reset();
+    nukiClock->sleepMs(10);
+  }
+}
+
+uint32_t NukiBle::getCoalescedRequestCount() const {
+  return coalescedRequests;
+}
+
+void NukiBle::getMetrics(NukiMetrics* snapshot) const {
+  metrics.snapshot(snapshot);
+  snapshot->coalescedRequests = coalescedRequests;
+  snapshot->notificationsProcessed = notificationsProcessed;
+  snapshot->notificationOverflows = notificationsOverflowed;
+  snapshot->advertisingIntervalMs = advertisementWindow.getIntervalMs();
+}
+
+std::string NukiBle::getMetricsText() const {
+  NukiMetrics snapshot;
+  getMetrics(&snapshot);
+  return metricsToPrometheus(snapshot, deviceName);
+}
+
+void NukiBle::enableFrameTrace(const bool enable) {
+  frameRecorder.enable(enable);
+}
+
+size_t NukiBle::exportFrameTrace(Print& out) const {
+  return frameRecorder.writePcap(out);
+}
+
+void NukiBle::clearFrameTrace() {
+  frameRecorder.clear();
+}
+
+void NukiBle::startCommandTiming(const Command command, const int64_t startUs) {
+  memset(&currentTiming, 0, sizeof(currentTiming));
+  currentTiming.command = command;
+  currentTimingStartUs = startUs;
+  timingActive = true;
+}
+
+void NukiBle::markCommandPhase(const CommandPhase phase) {
+  if (!timingActive) {
+    return;
+  }
+  currentTiming.phaseUs[(uint8_t)phase] = esp_timer_get_time() - currentTimingStartUs;
+  currentTiming.reachedPhases |= (1 << (uint8_t)phase);
+}
+
+void NukiBle::finishCommandTiming(const Nuki::CmdResult result, uint16_t* reachedPhases) {
+  if (!timingActive) {
+    return;
+  }
+  markCommandPhase(CommandPhase::Completed);
+  if (reachedPhases != nullptr) {
+    *reachedPhases = currentTiming.reachedPhases;
+  }
+  currentTiming.result = result;
+  currentTiming.totalUs = currentTiming.phaseUs[(uint8_t)CommandPhase::Completed];
+  timingActive = false;
+  lastCommandTiming.write(currentTiming);
+  CommandTimingScope::record(currentTiming);
+  commandLatencies.record(currentTiming.command, currentTiming.totalUs / 1000);
+}
+
+CommandTiming NukiBle::getLastCommandTiming() const {
+  return lastCommandTiming.read();
+}
+
+bool NukiBle::getCommandLatency(const Command command, LatencyPercentiles* percentiles) const {
+  return commandLatencies.getPercentiles(command, percentiles);
+}
+
+void NukiBle::resetCommandLatencies() {
+  commandLatencies.reset();
+}
+
+void NukiBle::invalidateConfigCache() {
+  configCacheGeneration++;
+}
+
+uint32_t NukiBle::getConfigCacheGeneration() const {
+  return configCacheGeneration;
+}
+
+void NukiBle::resetConfigCache() {
+  //the configUpdateCount of another device says nothing about the cached config
+  configUpdateCountKnown = false;
+  invalidateConfigCache();
+}
+
+void NukiBle::updateConfigUpdateCount(const uint8_t configUpdateCount) {
+  //a config cached before the first state was received can not be validated against the count
+  if (!configUpdateCountKnown || configUpdateCount != lastConfigUpdateCount) {
+    invalidateConfigCache();
+  }
+  lastConfigUpdateCount = configUpdateCount;
+  configUpdateCountKnown = true;
+}
+
+uint32_t NukiBle::getStateAge() const {
+  if (!stateReceived) {
+    return UINT32_MAX;
+  }
+  return nukiClock->nowMs() - lastStateReceivedTs;
+}
+
+void NukiBle::markStateReceived() {
+  lastStateReceivedTs = nukiClock->nowMs();
+  stateReceived = true;
+}
+
+bool NukiBle::hasStateReceived() const {
+  return stateReceived;
+}
+
+bool NukiBle::isStateFresh(const uint32_t maxAgeMs) const {
+  return stateReceived && (nukiClock->nowMs() - lastStateReceivedTs) <= maxAgeMs;
+}
+
+void NukiBle::refreshStateInBackground() {
+  bool expected = false;
+  if (tasksStopping || !stateRefreshRunning.compare_exchange_strong(expected, true)) {
+    //a refresh is already on its way
+    return;
+  }
+  if (xTaskCreatePinnedToCore(&NukiBle::stateRefreshTask, "nukiRefresh", NUKI_STATE_REFRESH_TASK_STACK_SIZE, this,
+                              NUKI_STATE_REFRESH_TASK_PRIORITY, &stateRefreshTaskHandle, tskNO_AFFINITY) != pdPASS) {
+    log_w("Could not start background state refresh");
+    stateRefreshTaskHandle = nullptr;
+    stateRefreshRunning = false;
+  }
+}
+
+void NukiBle::stateRefreshTask(void* pvParameters) {
+  NukiBle* nukiBle = (NukiBle*)pvParameters;
+  Nuki::CmdResult result = nukiBle->refreshState();
+  if (result != Nuki::CmdResult::Success) {
+    log_w("Background state refresh failed: %d", (int)result);
+  }
+  nukiBle->stateRefreshTaskHandle = nullptr;
+  nukiBle->stateRefreshRunning = false;
+  vTaskDelete(NULL);
+}
+
 } // namespace Nuki
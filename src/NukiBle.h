@@ -14,9 +14,24 @@
 #include "NimBLEDevice.h"
 #include "NukiConstants.h"
 #include "NukiDataTypes.h"
+#include "NukiRingBuffer.h"
+#include "NukiEventBus.h"
+#include "NukiSeqLock.h"
+#include "NukiCommandLatency.h"
+#include "NukiMetrics.h"
+#include "NukiFrameRecorder.h"
+#include "NukiSemaphoreProfiler.h"
+#include "NukiClock.h"
+#include "NukiDeadline.h"
+#include "NukiAdaptiveTimeout.h"
+#include "NukiRetryPolicy.h"
+#include "NukiAdvertisementWindow.h"
+#include "NukiConnectionProfile.h"
+#include "NukiFrameReassembler.h"
 #include "Arduino.h"
 #include <Preferences.h>
 #include <esp_task_wdt.h>
+#include <esp_timer.h>
 #include <BleInterfaces.h>
 #include "sodium/crypto_secretbox.h"
 
@@ -25,7 +40,46 @@
 #define PAIRING_TIMEOUT 30000
 #define HEARTBEAT_TIMEOUT 30000
 
+#ifndef NUKI_NOTIFICATION_QUEUE_SIZE
+#define NUKI_NOTIFICATION_QUEUE_SIZE 8
+#endif
+//single notification (ATT MTU - 3), larger ones could not be reassembled anyway
+#ifndef NUKI_NOTIFICATION_FRAME_SIZE
+#define NUKI_NOTIFICATION_FRAME_SIZE NUKI_MAX_FRAME_SIZE
+#endif
+#ifndef NUKI_NOTIFICATION_TASK_STACK_SIZE
+#define NUKI_NOTIFICATION_TASK_STACK_SIZE 5120
+#endif
+#ifndef NUKI_NOTIFICATION_TASK_PRIORITY
+#define NUKI_NOTIFICATION_TASK_PRIORITY 2
+#endif
+#ifndef NUKI_SINGLE_FLIGHT_SLOTS
+#define NUKI_SINGLE_FLIGHT_SLOTS 4
+#endif
+#ifndef NUKI_STATE_REFRESH_TASK_STACK_SIZE
+#define NUKI_STATE_REFRESH_TASK_STACK_SIZE 8192
+#endif
+#ifndef NUKI_STATE_REFRESH_TASK_PRIORITY
+#define NUKI_STATE_REFRESH_TASK_PRIORITY 1
+#endif
+#ifndef NUKI_ADVERT_SYNC_MAX_WAIT
+#define NUKI_ADVERT_SYNC_MAX_WAIT 2000
+#endif
+#ifndef NUKI_ADVERT_SYNC_MARGIN
+#define NUKI_ADVERT_SYNC_MARGIN 20
+#endif
+#ifndef NUKI_ADVERT_SYNC_POLL
+#define NUKI_ADVERT_SYNC_POLL 5
+#endif
+
 namespace Nuki {
+
+struct NotificationFrame {
+  NotificationSource source;
+  uint16_t length;
+  uint8_t data[NUKI_NOTIFICATION_FRAME_SIZE];
+};
+
 class NukiBle : public BLEClientCallbacks, public BleScanner::Subscriber {
   public:
     NukiBle(const std::string& deviceName,
@@ -38,12 +92,45 @@ class NukiBle : public BLEClientCallbacks, public BleScanner::Subscriber {
     virtual ~NukiBle();
 
     /**
-     * @brief Set the Event Handler object
+     * @brief Set the Event Handler object, the handler will be notified of KeyTurnerStatusUpdated events
+     * (replaces the handler set earlier by this method)
      *
      * @param handler method to handle the event
      */
     void setEventHandler(Nuki::SmartlockEventHandler* handler);
 
+    /**
+     * @brief Subscribes a handler to the typed events of this device. Events are delivered asynchronously
+     * from the event task, a slow handler does not block BLE or advertisement processing.
+     *
+     * @param handler handler to be notified
+     * @param eventMask combination of Nuki::eventMask() values, default all events
+     * @return false if the maximum nr of subscribers is reached
+     */
+    bool subscribeEvents(Nuki::SmartlockEventHandler* handler, const uint32_t eventMask = ALL_EVENTS);
+
+    /**
+     * @brief Removes all event subscriptions and state watches of handler
+     */
+    void unsubscribeEvents(Nuki::SmartlockEventHandler* handler);
+
+    /**
+     * @brief Watches a single field of the keyturner/opener state. Each received state is diffed against
+     * the previous one, the handler receives a StateFieldChanged event when the field changed and the
+     * predicate matches, e.g. addStateWatch(&handler, StateField::BatteryPercentage, Nuki::valueBelow(20))
+     *
+     * @param handler handler to be notified
+     * @param field state field to watch
+     * @param predicate filter on the change, nullptr for every change
+     * @return watch id to be used with removeStateWatch(), 0 if no more watches can be added
+     */
+    uint8_t addStateWatch(Nuki::SmartlockEventHandler* handler, const StateField field, StateWatchPredicate predicate = nullptr);
+
+    /**
+     * @brief Removes a watch added with addStateWatch()
+     */
+    void removeStateWatch(const uint8_t watchId);
+
     /**
      * @brief Checks if credentials are stored in preferences, if not initiate pairing
      *
@@ -190,7 +277,8 @@ class NukiBle : public BLEClientCallbacks, public BleScanner::Subscriber {
 
     /**
      * @brief Gets the pincode stored on the esp. This pincode is used for sending/setting config via BLE to the lock
-     * by other methods and needs to be the same pincode as stored in the lock
+     * by other methods and needs to be the same pincode as stored in the lock.
+     * Does not wait for a running command.
      *
      * @return pincode
      */
@@ -236,6 +324,12 @@ class NukiBle : public BLEClientCallbacks, public BleScanner::Subscriber {
      */
     void registerBleScanner(BleScanner::Publisher* bleScanner);
 
+    /**
+    * @brief Returns a consistent snapshot of RSSI, last beacon and last heartbeat timestamps without
+    * taking any lock
+    */
+    AdvertisementState getAdvertisementState() const;
+
     /**
     * @brief Returns the RSSI of the last received ble beacon broadcast
     *
@@ -264,13 +358,253 @@ class NukiBle : public BLEClientCallbacks, public BleScanner::Subscriber {
     */
     uint32_t getLastHeartbeat();
 
+    /**
+    * @brief Returns the fill level and drop counters of the queue between the BLE notify callback
+    * and the notification processing task
+    *
+    * @return NotificationQueueStats snapshot
+    */
+    NotificationQueueStats getNotificationQueueStats() const;
+
+    /**
+    * @brief Returns the time in milliseconds since the last keyturner/opener state has been received
+    * from the device
+    *
+    * @return age in milliseconds, UINT32_MAX if no state has been received yet
+    */
+    uint32_t getStateAge() const;
+
+    /**
+    * @brief Returns the number of read requests that did not cause a BLE exchange of their own because
+    * they joined an identical request already in flight
+    */
+    uint32_t getCoalescedRequestCount() const;
+
+    /**
+    * @brief Discards the cached config and advanced config, the next requestConfig() / requestAdvancedConfig()
+    * reads them from the device again. Normally not needed as the cache is invalidated when the
+    * configUpdateCount in the keyturner/opener state changes
+    */
+    void invalidateConfigCache();
+
+    /**
+    * @brief Returns the phase timestamps of the last finished command (of any task), use a
+    * Nuki::CommandTimingScope to get the timing of a specific call when multiple tasks send commands
+    *
+    * @return CommandTiming, phases not reached by the command are not set in reachedPhases
+    */
+    CommandTiming getLastCommandTiming() const;
+
+    /**
+    * @brief Returns p50/p95/p99 and max of the total duration of all commands of a type since start
+    * or the last resetCommandLatencies()
+    *
+    * @param command the command type, e.g. Command::LockAction or Command::RequestData
+    * @param percentiles is filled with the latencies in milliseconds
+    * @return false if no command of this type has been executed
+    */
+    bool getCommandLatency(const Command command, LatencyPercentiles* percentiles) const;
+
+    /**
+    * @brief Clears all latency histograms
+    */
+    void resetCommandLatencies();
+
+    /**
+    * @brief Enables/disables response timeouts learned per command from the observed response times
+    * (smoothed response time + 4 * deviation, between NUKI_ADAPTIVE_TIMEOUT_MIN and CMD_TIMEOUT).
+    * Enabled by default, when disabled CMD_TIMEOUT applies. Response times are recorded in both cases.
+    */
+    void setAdaptiveTimeouts(const bool enable);
+
+    /**
+    * @brief Copies the current response time estimates and applied timeouts per command
+    *
+    * @return number of estimates written
+    */
+    uint8_t getTimeoutEstimates(TimeoutEstimate* estimates, const uint8_t maxCount = NUKI_ADAPTIVE_TIMEOUT_SLOTS) const;
+
+    /**
+    * @brief Forgets all learned response times, e.g. after moving the ESP32 or the lock
+    */
+    void resetAdaptiveTimeouts();
+
+    /**
+    * @brief Sets retries with backoff for commands failing on lock busy, connect failure, CRC failure or timeout
+    * and the BLE connect attempts, see RetryPolicy. Commands that are not idempotent are never executed twice.
+    *
+    * @param policy the new policy, retryBudget 0 disables command retries
+    */
+    void setRetryPolicy(const RetryPolicy& policy);
+    RetryPolicy getRetryPolicy() const;
+
+    /**
+    * @brief When enabled a connect attempt waits for the next advertisement of the lock (at most two learned
+    * advertising intervals, NUKI_ADVERT_SYNC_MAX_WAIT and half the remaining deadline) and connects right after it,
+    * when the lock accepts connections most reliably. Disabled by default.
+    */
+    void setConnectOnAdvertisement(const bool enable);
+
+    /**
+    * @brief Returns the advertising interval of the lock learned from received advertisements, 0 if not known yet
+    */
+    uint32_t getAdvertisingIntervalMs() const;
+
+    /**
+    * @brief Sets the connection parameters and minimum ATT MTU of a profile. New connections are opened with the
+    * profile of the calling task (see ConnectionProfileScope), a connected session is switched with a connection
+    * parameter update. The MTU is negotiated by NimBLE when a connection is opened with the preferred MTU of the
+    * application (NimBLEDevice::setMTU()), a lower negotiated MTU is logged. The session relaxes to
+    * ConnectionProfile::Idle after NUKI_IDLE_PROFILE_DELAY ms without traffic when updateConnectionState() is used.
+    */
+    void setConnectionParameters(const ConnectionProfile profile, const ConnectionParameters& parameters);
+    ConnectionParameters getConnectionParameters(const ConnectionProfile profile) const;
+
+    /**
+    * @brief Returns the profile of the current session, ConnectionProfile::Default if not connected
+    */
+    ConnectionProfile getConnectionProfile() const;
+
+    /**
+    * @brief Copies the protocol health counters (commands per type and result, connects, CRC/decrypt failures,
+    * lock busy, heartbeat and semaphore timeouts, adverts) since start
+    *
+    * @param snapshot is filled with the current counter values
+    */
+    void getMetrics(NukiMetrics* snapshot) const;
+
+    /**
+    * @brief Returns the counters of getMetrics() in Prometheus text format labeled with the device name
+    */
+    std::string getMetricsText() const;
+
+    /**
+    * @brief Copies wait and hold time stats of the BLE semaphore per taker, worst offender (most wait time
+    * caused for other takers) first
+    *
+    * @param stats array of at least maxCount entries
+    * @return number of entries written
+    */
+    uint8_t getSemaphoreProfile(SemaphoreTagStats* stats, const uint8_t maxCount = SEMAPHORE_TAG_COUNT) const;
+
+    /**
+    * @brief Prints the semaphore profile as a table, worst offender first
+    */
+    void dumpSemaphoreProfile(Print& out) const;
+
+    void resetSemaphoreProfile();
+
+    /**
+    * @brief Enables/disables recording of the last NUKI_TRACE_FRAMES sent and received plaintext messages
+    * in a ring buffer, disabled by default. Recording does not log and hardly changes timing
+    *
+    * @param enable true to record
+    */
+    void enableFrameTrace(const bool enable);
+
+    /**
+    * @brief Writes the recorded messages as pcap (link type USER0, format described in NukiFrameRecorder.h)
+    *
+    * @param out destination, e.g. Serial, a File or a WiFiClient
+    * @return number of bytes written
+    */
+    size_t exportFrameTrace(Print& out) const;
+
+    /**
+    * @brief Discards all recorded messages
+    */
+    void clearFrameTrace();
+
+    /**
+    * @brief Installs a tap that sees (and may consume) every message before it is sent, nullptr removes the tap.
+    * While a consuming tap is installed no BLE connection is made, see TraceReplayer
+    *
+    * @param tap the tap, must outlive its registration
+    */
+    void setMessageTap(MessageTap* tap);
+
+    /**
+    * @brief Processes a plaintext message as if it had been received (and decrypted) from the device. The message
+    * is handled by the notification task after the notifications already queued, the call returns when it is done.
+    * Only to be used while no real BLE connection is active
+    *
+    * @param source characteristic the message was received on
+    * @param plaintext message including CRC, for USDIO starting with the authorization id
+    * @param length length of plaintext
+    * @param processingUs if set, receives the time the notification task spent handling the message
+    * @return false if the length or CRC is invalid
+    */
+    bool injectReceivedMessage(const NotificationSource source, const uint8_t* plaintext, const uint16_t length,
+                               uint32_t* processingUs = nullptr);
+
+    /**
+    * @brief Handles an advertisement from the device as if received by the scanner
+    *
+    * @param rssi signal strength to be reported
+    * @param stateChanged true if the advertisement signals a state change (KeyTurnerStatusUpdated event)
+    */
+    void injectAdvertisement(const int rssi, const bool stateChanged = false);
+
+    /**
+    * @brief Handles the loss of the link as if reported by the BLE stack, used by a message tap modelling the link
+    */
+    void injectDisconnect();
+
+    /**
+    * @brief Replaces the time source of all timeouts and polling delays, e.g. by a VirtualClock for simulation.
+    * To be set before initialize()
+    *
+    * @param clock the clock, must outlive the device
+    */
+    void setClock(Clock* clock);
+
+    /**
+    * @brief Returns the time source in use, by default the systemClock (millis() / delay())
+    */
+    Clock* getClock() const;
+
   protected:
-    bool connectBle(const BLEAddress bleAddress);
+    /**
+     * @brief Connects if not connected and subscribes the characteristic in use, the pairing service is only
+     * touched when pairing is true
+     */
+    bool connectBle(const BLEAddress bleAddress, const bool pairing = false);
+    /**
+     * @brief Scans until the next advertisement of the lock arrives, bounded by the learned advertising interval
+     *
+     * @return true if an advertisement was received, false on timeout or if the lock was not seen lately
+     */
+    bool awaitAdvertisement();
+    void enableScanning(const bool enable);
+    AdvertisementWindow advertisementWindow;
+    std::atomic<bool> connectOnAdvertisement{false};
+
+    /**
+     * @brief Switches the session to profile, with a connection parameter update if connected
+     */
+    void useConnectionProfile(const ConnectionProfile profile);
+    void enterConnectionProfile(const ConnectionProfile profile, const uint16_t mtu, const uint16_t connInterval);
+    void leaveConnectionProfile();
+    SeqLock<ConnectionParameters> connectionParameters[CONNECTION_PROFILE_COUNT];
+    //profile of the current session, guarded by profileMux
+    ConnectionProfile activeProfile = ConnectionProfile::Default;
+    bool profileActive = false;
+    uint32_t profileSinceMs = 0;
+    uint32_t profileMessagesAtStart = 0;
+    mutable portMUX_TYPE profileMux = portMUX_INITIALIZER_UNLOCKED;
+    std::atomic<uint32_t> messagesReceived{0};
+    std::atomic<uint32_t> lastMessageMs{0};
     void extendDisonnectTimeout();
 
     template <typename TDeviceAction>
     Nuki::CmdResult executeAction(const TDeviceAction action);
 
+    /**
+     * @param reachedPhases if set, receives the CommandPhase bits reached by the command
+     */
+    template <typename TDeviceAction>
+    Nuki::CmdResult runAction(const TDeviceAction action, uint16_t* reachedPhases = nullptr);
+
     template <typename TDeviceAction>
     Nuki::CmdResult cmdStateMachine(const TDeviceAction action);
 
@@ -281,16 +615,105 @@ class NukiBle : public BLEClientCallbacks, public BleScanner::Subscriber {
     Nuki::CmdResult cmdChallAccStateMachine(const TDeviceAction action);
 
   protected:
+    /**
+     * @brief Lets the notification and background refresh task finish their current work and waits until they
+     * exited. Called by the destructors of the derived classes, the tasks call their virtual methods.
+     */
+    void stopTasks();
+    std::atomic<bool> tasksStopping{false};
     virtual void handleReturnMessage(Command returnCode, unsigned char* data, uint16_t dataLen);
     virtual void logErrorCode(uint8_t errorCode) = 0;
+    /**
+     * @brief Requests the keyturner/opener state via BLE, called from the background refresh task
+     */
+    virtual Nuki::CmdResult refreshState() = 0;
+    void markStateReceived();
+    bool isStateFresh(const uint32_t maxAgeMs) const;
+    bool hasStateReceived() const;
+    void refreshStateInBackground();
+    void updateConfigUpdateCount(const uint8_t configUpdateCount);
+    /**
+     * @brief Discards the cached config and the last known configUpdateCount, used when the paired device changes
+     */
+    void resetConfigCache();
+    uint32_t getConfigCacheGeneration() const;
+    void publishEvent(Event event);
+    void publishFieldChange(const StateField field, const int32_t previous, const int32_t current);
     uint8_t errorCode;
     Command lastMsgCodeReceived = Command::Empty;
 
   private:
+    struct SingleFlightSlot {
+      uint32_t key = 0;
+      bool active = false;
+      uint8_t waiters = 0;
+      uint32_t generation = 0;
+      Nuki::CmdResult result = Nuki::CmdResult::Failed;
+    };
+
+    struct SingleFlightTicket {
+      int8_t slot = -1;
+      bool leader = false;
+      uint32_t generation = 0;
+    };
+
+    static uint32_t singleFlightKey(const Command command, const unsigned char* payload, const uint8_t payloadLen);
+    SingleFlightTicket beginSingleFlight(const uint32_t key);
+    void endSingleFlight(const SingleFlightTicket& ticket, const Nuki::CmdResult result);
+    Nuki::CmdResult awaitSingleFlight(const SingleFlightTicket& ticket);
+    SingleFlightSlot singleFlightSlots[NUKI_SINGLE_FLIGHT_SLOTS];
+    SemaphoreHandle_t singleFlightSemaphore = xSemaphoreCreateMutex();
+    std::atomic<uint32_t> coalescedRequests{0};
+
     SemaphoreHandle_t nukiBleSemaphore = xSemaphoreCreateMutex();
-    bool takeNukiBleSemaphore(std::string taker);
-    std::string owner = "free";
+    /**
+     * @brief Maps results of a command running out of the budget of the active DeadlineScope to DeadlineExceeded
+     * and resets the command state machine
+     */
+    Nuki::CmdResult applyDeadline(const Nuki::CmdResult result);
+    bool connectGaveUpOnDeadline = false;
+
+    struct RetryState {
+      uint8_t retries = 0;
+      uint8_t retriesPerReason[RETRY_REASON_COUNT] = {0};
+      uint32_t crcFailures = 0;     //metrics at the start of the attempt, to attribute the failure
+      uint32_t connectFailures = 0;
+    };
+
+    void beginAttempt(RetryState& state);
+
+    /**
+     * @brief Decides on a retry of a failed attempt according to policy and waits the backoff
+     *
+     * @return true if the command should be executed again
+     */
+    bool retryAfterFailure(const Command command, const CommandType cmdType, const Nuki::CmdResult result,
+                           const uint16_t reachedPhases, const RetryPolicy& policy, RetryState& state);
+    SeqLock<RetryPolicy> retryPolicy;
+
+    bool takeNukiBleSemaphore(const SemaphoreTag tag);
     void giveNukiBleSemaphore();
+    std::atomic<SemaphoreTag> owner{SemaphoreTag::Free};
+    int64_t ownerSinceUs = 0;
+    SemaphoreProfiler semaphoreProfiler;
+
+    /**
+     * @brief Subscribes the characteristic needed on this connection, GDIO only when pairing, otherwise USDIO
+     */
+    bool subscribeCharacteristic(const bool pairing);
+    /**
+     * @brief Resubscribes to the USDIO characteristic kept in memory from an earlier connection, skipping service
+     * discovery. The cache is not persisted, NimBLE-Arduino cannot create a remote characteristic from a stored handle
+     * and only delivers indications to discovered ones, so the first connection after boot discovers.
+     *
+     * @return false if nothing is cached or subscribing the cached attribute failed (the cache is dropped then)
+     */
+    bool subscribeCachedAttributes();
+    void invalidateAttributeCache();
+    bool attributesCached = false;
+    //subscriptions on the current connection, reset in onDisconnect()
+    std::atomic<bool> gdioSubscribed{false};
+    std::atomic<bool> usdioSubscribed{false};
 
     bool connecting = false;
     uint32_t lastStartTimeout = 0;
@@ -305,6 +728,11 @@ class NukiBle : public BLEClientCallbacks, public BleScanner::Subscriber {
     bool sendEncryptedMessage(Command commandIdentifier, const unsigned char* payload, const uint8_t payloadLen);
 
     void notifyCallback(BLERemoteCharacteristic* pBLERemoteCharacteristic, uint8_t* pData, size_t length, bool isNotify);
+    void processNotification(const NotificationFrame& frame);
+    bool handlePlaintextMessage(const NotificationSource source, const uint8_t* plaintext, const uint16_t length);
+    void handleBeacon(const int rssi, const bool stateChanged);
+    void processNotificationQueue();
+    static void notificationTask(void* pvParameters);
     void saveCredentials();
     bool retrieveCredentials();
     void deleteCredentials();
@@ -339,12 +767,24 @@ class NukiBle : public BLEClientCallbacks, public BleScanner::Subscriber {
     Nuki::CommandState nukiCommandState = Nuki::CommandState::Idle;
 
     uint32_t timeNow = 0;
-    uint32_t lastHeartbeat = 0;
+
+    static uint8_t timeoutVariant(const Command command, const unsigned char* payload, const uint8_t payloadLen);
+    void startResponseTimer(const Command command, const uint8_t variant, const ResponsePhase phase);
+    bool responseTimedOut();
+    void responseReceived();
+    AdaptiveTimeoutTable adaptiveTimeouts{CMD_TIMEOUT};
+    std::atomic<bool> adaptiveTimeoutsEnabled{true};
+    //awaited response, only accessed by the task holding nukiBleSemaphore
+    Command responseCommand = Command::Empty;
+    uint8_t responseVariant = 0;
+    ResponsePhase responsePhase = ResponsePhase::Response;
+    uint32_t responseTimeoutMs = CMD_TIMEOUT;
 
     BleScanner::Publisher* bleScanner = nullptr;
     bool isPaired = false;
 
-    Nuki::SmartlockEventHandler* eventHandler;
+    Nuki::SmartlockEventHandler* eventHandler = nullptr;
+    EventBus eventBus;
 
     uint8_t receivedStatus;
     bool crcCheckOke;
@@ -355,17 +795,68 @@ class NukiBle : public BLEClientCallbacks, public BleScanner::Subscriber {
     unsigned char myPublicKey[32] = {0x00};
     unsigned char myPrivateKey[32] = {0x00};
     uint16_t pinCode = 0000;
+    std::atomic<uint16_t> storedPincode{0};
     unsigned char secretKeyK[32] = {0x00};
 
     unsigned char sentNonce[crypto_secretbox_NONCEBYTES] = {};
 
+    SpscRingBuffer<NotificationFrame, NUKI_NOTIFICATION_QUEUE_SIZE> notificationQueue;
+    std::atomic<TaskHandle_t> notificationTaskHandle{nullptr};
+    std::atomic<uint32_t> notificationsOverflowed{0};
+    std::atomic<uint32_t> notificationsOversized{0};
+    //only used by the notification task
+    FrameReassembler gdioReassembler{NotificationSource::Gdio};
+    FrameReassembler usdioReassembler{NotificationSource::Usdio};
+    std::atomic<uint32_t> notificationsProcessed{0};
+    struct InjectedMessage {
+      NotificationSource source;
+      const uint8_t* plaintext;
+      uint16_t length;
+      bool accepted;
+      uint32_t processingUs;
+    };
+    //one injected message at a time is handed to the notification task
+    SemaphoreHandle_t injectSemaphore = xSemaphoreCreateMutex();
+    SemaphoreHandle_t injectDoneSemaphore = xSemaphoreCreateBinary();
+    std::atomic<InjectedMessage*> pendingInjection{nullptr};
+    void processInjectedMessage();
+    void handleInjectedMessage(InjectedMessage& message);
+    std::atomic<uint32_t> notificationQueueHighWaterMark{0};
+
+    std::atomic<bool> stateReceived{false};
+    std::atomic<uint32_t> lastStateReceivedTs{0};
+    std::atomic<bool> stateRefreshRunning{false};
+    TaskHandle_t stateRefreshTaskHandle = nullptr;
+
+    //only accessed by the task holding nukiBleSemaphore
+    CommandTiming currentTiming;
+    int64_t currentTimingStartUs = 0;
+    bool timingActive = false;
+    void startCommandTiming(const Command command, const int64_t startUs);
+    void markCommandPhase(const CommandPhase phase);
+    void finishCommandTiming(const Nuki::CmdResult result, uint16_t* reachedPhases = nullptr);
+    SeqLock<CommandTiming> lastCommandTiming;
+    CommandLatencyTable commandLatencies;
+    MetricsCounters metrics;
+    FrameRecorder frameRecorder;
+    std::atomic<MessageTap*> messageTap{nullptr};
+    /**
+     * @brief The installed tap if it simulates the link, nullptr if the BLE client is used
+     */
+    MessageTap* getLinkTap() const;
+    Clock* nukiClock = &systemClock;
+
+    std::atomic<uint32_t> configCacheGeneration{1};
+    std::atomic<bool> configUpdateCountKnown{false};
+    uint8_t lastConfigUpdateCount = 0;
+    static void stateRefreshTask(void* pvParameters);
+
     uint16_t nrOfKeypadCodes = 0;
     uint8_t nrOfReceivedKeypadCodes = 0;
     bool keypadCodeCountReceived = false;
     uint16_t logEntryCount = 0;
     bool loggingEnabled = false;
-    int rssi = 0;
-    unsigned long lastReceivedBeaconTs = 0;
+    SeqLock<AdvertisementState> advertisementState;
     std::list<KeypadEntry> listOfKeyPadEntries;
     std::list<AuthorizationEntry> listOfAuthorizationEntries;
     AuthorizationIdType authorizationIdType = AuthorizationIdType::Bridge;
@@ -4,7 +4,37 @@
 namespace Nuki {
 template<typename TDeviceAction>
 Nuki::CmdResult NukiBle::executeAction(const TDeviceAction action) {
-  if (millis() - lastHeartbeat > HEARTBEAT_TIMEOUT) {
+  if (DeadlineScope::expired()) {
+    metrics.recordCommand(action.command, Nuki::CmdResult::DeadlineExceeded);
+    return Nuki::CmdResult::DeadlineExceeded;
+  }
+
+  SingleFlightTicket ticket = beginSingleFlight(singleFlightKey(action.command, action.payload, action.payloadLen));
+  if (ticket.slot >= 0 && !ticket.leader) {
+    return awaitSingleFlight(ticket);
+  }
+
+  RetryPolicy policy = retryPolicy.read();
+  RetryState retryState;
+  Nuki::CmdResult result;
+  while (1) {
+    uint16_t reachedPhases = 0;
+    beginAttempt(retryState);
+    result = runAction(action, &reachedPhases);
+    if (!retryAfterFailure(action.command, action.cmdType, result, reachedPhases, policy, retryState)) {
+      break;
+    }
+  }
+  metrics.recordCommand(action.command, result);
+  endSingleFlight(ticket, result);
+  return result;
+}
+
+template<typename TDeviceAction>
+Nuki::CmdResult NukiBle::runAction(const TDeviceAction action, uint16_t* reachedPhases) {
+  int64_t startUs = esp_timer_get_time();
+  if (nukiClock->nowMs() - advertisementState.read().lastHeartbeat > HEARTBEAT_TIMEOUT) {
+    metrics.heartbeatTimeouts++;
     log_e("Lock Heartbeat timeout, command failed");
     return Nuki::CmdResult::Error;
   }
@@ -23,58 +53,68 @@ Nuki::CmdResult NukiBle::executeAction(const TDeviceAction action) {
     return Nuki::CmdResult::NotPaired;
   }
 
-  if (takeNukiBleSemaphore("exec Action")) {
+  if (takeNukiBleSemaphore(SemaphoreTag::ExecAction)) {
+    startCommandTiming(action.command, startUs);
+    markCommandPhase(CommandPhase::SemaphoreAcquired);
+    useConnectionProfile(ConnectionProfileScope::current());
     #ifdef DEBUG_NUKI_COMMUNICATION
     log_d("Start executing: %02x ", action.command);
     #endif
     if (action.cmdType == Nuki::CommandType::Command) {
       while (1) {
-        Nuki::CmdResult result = cmdStateMachine(action);
+        Nuki::CmdResult result = applyDeadline(cmdStateMachine(action));
         if (result != Nuki::CmdResult::Working) {
+          finishCommandTiming(result, reachedPhases);
           giveNukiBleSemaphore();
           extendDisonnectTimeout();
           return result;
         }
         esp_task_wdt_reset();
-        delay(10);
+        nukiClock->sleepMs(10);
       }
     } else if (action.cmdType == Nuki::CommandType::CommandWithChallenge) {
       while (1) {
-        Nuki::CmdResult result = cmdChallStateMachine(action);
+        Nuki::CmdResult result = applyDeadline(cmdChallStateMachine(action));
         if (result != Nuki::CmdResult::Working) {
+          finishCommandTiming(result, reachedPhases);
           giveNukiBleSemaphore();
           extendDisonnectTimeout();
           return result;
         }
         esp_task_wdt_reset();
-        delay(10);
+        nukiClock->sleepMs(10);
       }
     } else if (action.cmdType == Nuki::CommandType::CommandWithChallengeAndAccept) {
       while (1) {
-        Nuki::CmdResult result = cmdChallAccStateMachine(action);
+        Nuki::CmdResult result = applyDeadline(cmdChallAccStateMachine(action));
         if (result != Nuki::CmdResult::Working) {
+          finishCommandTiming(result, reachedPhases);
           giveNukiBleSemaphore();
           extendDisonnectTimeout();
           return result;
         }
         esp_task_wdt_reset();
-        delay(10);
+        nukiClock->sleepMs(10);
       }
     } else if (action.cmdType == Nuki::CommandType::CommandWithChallengeAndPin) {
       while (1) {
-        Nuki::CmdResult result = cmdChallStateMachine(action, true);
+        Nuki::CmdResult result = applyDeadline(cmdChallStateMachine(action, true));
         if (result != Nuki::CmdResult::Working) {
+          finishCommandTiming(result, reachedPhases);
           giveNukiBleSemaphore();
           extendDisonnectTimeout();
           return result;
         }
         esp_task_wdt_reset();
-        delay(10);
+        nukiClock->sleepMs(10);
       }
     } else {
       log_w("Unknown cmd type");
     }
+    finishCommandTiming(Nuki::CmdResult::Failed, reachedPhases);
     giveNukiBleSemaphore();
+  } else if (DeadlineScope::expired()) {
+    return Nuki::CmdResult::DeadlineExceeded;
   }
   return Nuki::CmdResult::Failed;
 }
@@ -89,8 +129,9 @@ Nuki::CmdResult NukiBle::cmdStateMachine(const TDeviceAction action) {
       lastMsgCodeReceived = Command::Empty;
 
       if (sendEncryptedMessage(Command::RequestData, action.payload, action.payloadLen)) {
-        timeNow = millis();
+        startResponseTimer(action.command, timeoutVariant(action.command, action.payload, action.payloadLen), ResponsePhase::Response);
         nukiCommandState = CommandState::CmdSent;
+        markCommandPhase(CommandPhase::CommandSent);
       } else {
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ SENDING COMMAND FAILED ************************");
@@ -102,11 +143,12 @@ Nuki::CmdResult NukiBle::cmdStateMachine(const TDeviceAction action) {
       break;
     }
     case CommandState::CmdSent: {
-      if (millis() - timeNow > CMD_TIMEOUT) {
+      if (responseTimedOut()) {
         log_w("************************ COMMAND FAILED TIMEOUT************************");
         nukiCommandState = CommandState::Idle;
         return Nuki::CmdResult::TimeOut;
       } else if (lastMsgCodeReceived != Command::ErrorReport && lastMsgCodeReceived != Command::Empty) {
+        responseReceived();
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ COMMAND DONE ************************");
         #endif
@@ -114,6 +156,7 @@ Nuki::CmdResult NukiBle::cmdStateMachine(const TDeviceAction action) {
         lastMsgCodeReceived = Command::Empty;
         return Nuki::CmdResult::Success;
       } else if (lastMsgCodeReceived == Command::ErrorReport && errorCode != 69) {
+        responseReceived();
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ COMMAND FAILED ************************");
         #endif
@@ -121,6 +164,7 @@ Nuki::CmdResult NukiBle::cmdStateMachine(const TDeviceAction action) {
         lastMsgCodeReceived = Command::Empty;
         return Nuki::CmdResult::Failed;
       } else if (lastMsgCodeReceived == Command::ErrorReport && errorCode == 69) {
+        responseReceived();
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ COMMAND FAILED LOCK BUSY ************************");
         #endif
@@ -150,8 +194,9 @@ Nuki::CmdResult NukiBle::cmdChallStateMachine(const TDeviceAction action, const
       unsigned char payload[sizeof(Command)] = {0x04, 0x00};  //challenge
 
       if (sendEncryptedMessage(Command::RequestData, payload, sizeof(Command))) {
-        timeNow = millis();
+        startResponseTimer(Command::Challenge, 0, ResponsePhase::Response);
         nukiCommandState = CommandState::ChallengeSent;
+        markCommandPhase(CommandPhase::ChallengeSent);
       } else {
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ SENDING CHALLENGE FAILED ************************");
@@ -166,12 +211,14 @@ Nuki::CmdResult NukiBle::cmdChallStateMachine(const TDeviceAction action, const
       #ifdef DEBUG_NUKI_COMMUNICATION
       log_d("************************ RECEIVING CHALLENGE RESPONSE************************");
       #endif
-      if (millis() - timeNow > CMD_TIMEOUT) {
+      if (responseTimedOut()) {
         log_w("************************ COMMAND FAILED TIMEOUT ************************");
         nukiCommandState = CommandState::Idle;
         return Nuki::CmdResult::TimeOut;
       } else if (lastMsgCodeReceived == Command::Challenge) {
+        responseReceived();
         nukiCommandState = CommandState::ChallengeRespReceived;
+        markCommandPhase(CommandPhase::ChallengeReceived);
         lastMsgCodeReceived = Command::Empty;
       }
       break;
@@ -195,8 +242,9 @@ Nuki::CmdResult NukiBle::cmdChallStateMachine(const TDeviceAction action, const
       }
 
       if (sendEncryptedMessage(action.command, payload, payloadLen)) {
-        timeNow = millis();
+        startResponseTimer(action.command, timeoutVariant(action.command, action.payload, action.payloadLen), ResponsePhase::Response);
         nukiCommandState = CommandState::CmdSent;
+        markCommandPhase(CommandPhase::CommandSent);
       } else {
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ SENDING COMMAND FAILED ************************");
@@ -211,11 +259,12 @@ Nuki::CmdResult NukiBle::cmdChallStateMachine(const TDeviceAction action, const
       #ifdef DEBUG_NUKI_COMMUNICATION
       log_d("************************ RECEIVING DATA ************************");
       #endif
-      if (millis() - timeNow > CMD_TIMEOUT) {
+      if (responseTimedOut()) {
         log_w("************************ COMMAND FAILED TIMEOUT ************************");
         nukiCommandState = CommandState::Idle;
         return Nuki::CmdResult::TimeOut;
       } else if (lastMsgCodeReceived == Command::ErrorReport && errorCode != 69) {
+        responseReceived();
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ COMMAND FAILED ************************");
         #endif
@@ -223,6 +272,7 @@ Nuki::CmdResult NukiBle::cmdChallStateMachine(const TDeviceAction action, const
         lastMsgCodeReceived = Command::Empty;
         return Nuki::CmdResult::Failed;
       } else if (lastMsgCodeReceived == Command::ErrorReport && errorCode == 69) {
+        responseReceived();
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ COMMAND FAILED LOCK BUSY ************************");
         #endif
@@ -230,6 +280,7 @@ Nuki::CmdResult NukiBle::cmdChallStateMachine(const TDeviceAction action, const
         lastMsgCodeReceived = Command::Empty;
         return Nuki::CmdResult::Lock_Busy;
       } else if (crcCheckOke) {
+        responseReceived();
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ DATA RECEIVED ************************");
         #endif
@@ -257,8 +308,9 @@ Nuki::CmdResult NukiBle::cmdChallAccStateMachine(const TDeviceAction action) {
       unsigned char payload[sizeof(Command)] = {0x04, 0x00};  //challenge
 
       if (sendEncryptedMessage(Command::RequestData, payload, sizeof(Command))) {
-        timeNow = millis();
+        startResponseTimer(Command::Challenge, 0, ResponsePhase::Response);
         nukiCommandState = CommandState::ChallengeSent;
+        markCommandPhase(CommandPhase::ChallengeSent);
       } else {
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ SENDING CHALLENGE FAILED ************************");
@@ -273,12 +325,14 @@ Nuki::CmdResult NukiBle::cmdChallAccStateMachine(const TDeviceAction action) {
       #ifdef DEBUG_NUKI_COMMUNICATION
       log_d("************************ RECEIVING CHALLENGE RESPONSE************************");
       #endif
-      if (millis() - timeNow > CMD_TIMEOUT) {
+      if (responseTimedOut()) {
         log_w("************************ COMMAND FAILED TIMEOUT ************************");
         nukiCommandState = CommandState::Idle;
         return Nuki::CmdResult::TimeOut;
       } else if (lastMsgCodeReceived == Command::Challenge) {
+        responseReceived();
         nukiCommandState = CommandState::ChallengeRespReceived;
+        markCommandPhase(CommandPhase::ChallengeReceived);
         lastMsgCodeReceived = Command::Empty;
       }
       break;
@@ -295,8 +349,9 @@ Nuki::CmdResult NukiBle::cmdChallAccStateMachine(const TDeviceAction action) {
       memcpy(&payload[action.payloadLen], challengeNonceK, sizeof(challengeNonceK));
 
       if (sendEncryptedMessage(action.command, payload, action.payloadLen + sizeof(challengeNonceK))) {
-        timeNow = millis();
+        startResponseTimer(action.command, timeoutVariant(action.command, action.payload, action.payloadLen), ResponsePhase::Response);
         nukiCommandState = CommandState::CmdSent;
+        markCommandPhase(CommandPhase::CommandSent);
       } else {
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ SENDING COMMAND FAILED ************************");
@@ -311,15 +366,18 @@ Nuki::CmdResult NukiBle::cmdChallAccStateMachine(const TDeviceAction action) {
       #ifdef DEBUG_NUKI_COMMUNICATION
       log_d("************************ RECEIVING ACCEPT ************************");
       #endif
-      if (millis() - timeNow > CMD_TIMEOUT) {
+      if (responseTimedOut()) {
         log_w("************************ ACCEPT FAILED TIMEOUT ************************");
         nukiCommandState = CommandState::Idle;
         return Nuki::CmdResult::TimeOut;
       } else if (lastMsgCodeReceived == Command::Status && (CommandStatus)receivedStatus == CommandStatus::Accepted) {
-        timeNow = millis();
+        responseReceived();
+        startResponseTimer(action.command, timeoutVariant(action.command, action.payload, action.payloadLen), ResponsePhase::Complete);
         nukiCommandState = CommandState::CmdAccepted;
+        markCommandPhase(CommandPhase::Accepted);
         lastMsgCodeReceived = Command::Empty;
       } else if (lastMsgCodeReceived == Command::Status && (CommandStatus)receivedStatus == CommandStatus::Complete) {
+        responseReceived();
         //accept was skipped on lock because ie unlock command when lock allready unlocked?
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ COMMAND SUCCESS (SKIPPED) ************************");
@@ -334,11 +392,12 @@ Nuki::CmdResult NukiBle::cmdChallAccStateMachine(const TDeviceAction action) {
       #ifdef DEBUG_NUKI_COMMUNICATION
       log_d("************************ RECEIVING COMPLETE ************************");
       #endif
-      if (millis() - timeNow > CMD_TIMEOUT) {
+      if (responseTimedOut()) {
         log_w("************************ COMMAND FAILED TIMEOUT ************************");
         nukiCommandState = CommandState::Idle;
         return Nuki::CmdResult::TimeOut;
       } else if (lastMsgCodeReceived == Command::ErrorReport && errorCode != 69) {
+        responseReceived();
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ COMMAND FAILED ************************");
         #endif
@@ -346,6 +405,7 @@ Nuki::CmdResult NukiBle::cmdChallAccStateMachine(const TDeviceAction action) {
         lastMsgCodeReceived = Command::Empty;
         return Nuki::CmdResult::Failed;
       } else if (lastMsgCodeReceived == Command::ErrorReport && errorCode == 69) {
+        responseReceived();
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ COMMAND FAILED LOCK BUSY ************************");
         #endif
@@ -353,6 +413,7 @@ Nuki::CmdResult NukiBle::cmdChallAccStateMachine(const TDeviceAction action) {
         lastMsgCodeReceived = Command::Empty;
         return Nuki::CmdResult::Lock_Busy;
       } else if ((CommandStatus)lastMsgCodeReceived == CommandStatus::Complete) {
+        responseReceived();
         #ifdef DEBUG_NUKI_COMMUNICATION
         log_d("************************ COMMAND SUCCESS ************************");
         #endif
@@ -0,0 +1,95 @@
+/**
+ * @file NukiClock.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiClock.h"
+
+namespace Nuki {
+
+SystemClock systemClock;
+
+uint32_t SystemClock::nowMs() {
+  return millis();
+}
+
+void SystemClock::sleepMs(const uint32_t ms) {
+  delay(ms);
+}
+
+VirtualClock::VirtualClock(const uint32_t startMs)
+  : now(startMs) {
+}
+
+uint32_t VirtualClock::nowMs() {
+  return now;
+}
+
+void VirtualClock::sleepMs(const uint32_t ms) {
+  advance(ms);
+  //a yield alone lets polling loops starve lower priority tasks (and the idle task watchdog)
+  vTaskDelay(1);
+}
+
+void VirtualClock::advance(const uint32_t ms) {
+  uint32_t target = now + ms;
+  ScheduledEvent event;
+  while (popDueEvent(target, event)) {
+    //callbacks can advance the clock themselves, never go back in time
+    if ((int32_t)(event.dueMs - now) > 0) {
+      now = event.dueMs;
+    }
+    event.callback();
+  }
+  if ((int32_t)(target - now) > 0) {
+    now = target;
+  }
+}
+
+void VirtualClock::schedule(const uint32_t delayMs, std::function<void()> callback) {
+  xSemaphoreTake(eventSemaphore, portMAX_DELAY);
+  events.push_back({now + delayMs, nextSequence++, callback});
+  xSemaphoreGive(eventSemaphore);
+}
+
+bool VirtualClock::popDueEvent(const uint32_t untilMs, ScheduledEvent& event) {
+  xSemaphoreTake(eventSemaphore, portMAX_DELAY);
+  int next = -1;
+  for (int i = 0; i < events.size(); i++) {
+    if ((int32_t)(events[i].dueMs - untilMs) > 0) {
+      continue;
+    }
+    if (next < 0 || (int32_t)(events[i].dueMs - events[next].dueMs) < 0
+        || (events[i].dueMs == events[next].dueMs && events[i].sequence < events[next].sequence)) {
+      next = i;
+    }
+  }
+  if (next >= 0) {
+    event = events[next];
+    events.erase(events.begin() + next);
+  }
+  xSemaphoreGive(eventSemaphore);
+  return next >= 0;
+}
+
+size_t VirtualClock::getPendingEventCount() {
+  xSemaphoreTake(eventSemaphore, portMAX_DELAY);
+  size_t count = events.size();
+  xSemaphoreGive(eventSemaphore);
+  return count;
+}
+
+void VirtualClock::clearEvents() {
+  xSemaphoreTake(eventSemaphore, portMAX_DELAY);
+  events.clear();
+  xSemaphoreGive(eventSemaphore);
+}
+
+} // namespace Nuki
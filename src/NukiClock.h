@@ -0,0 +1,96 @@
+#pragma once
+/**
+ * @file NukiClock.h
+ * Injectable time source for timeouts and polling loops
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include <atomic>
+#include <functional>
+#include <vector>
+
+namespace Nuki {
+
+/**
+ * @brief Time source used for all library timeouts (command, pairing, heartbeat, disconnect) and polling delays
+ */
+class Clock {
+  public:
+    virtual ~Clock() {};
+
+    /**
+     * @brief Milliseconds since an arbitrary start, wraps like millis()
+     */
+    virtual uint32_t nowMs() = 0;
+
+    /**
+     * @brief Blocks the calling task for ms milliseconds of this clock
+     */
+    virtual void sleepMs(const uint32_t ms) = 0;
+};
+
+/**
+ * @brief Default clock based on millis() and delay()
+ */
+class SystemClock : public Clock {
+  public:
+    constexpr SystemClock() {}
+
+    uint32_t nowMs() override;
+    void sleepMs(const uint32_t ms) override;
+};
+
+extern SystemClock systemClock;
+
+/**
+ * @brief Clock only advanced by sleepMs() / advance(), sleeping blocks for a single FreeRTOS tick whatever the
+ * duration so hours of heartbeat, disconnect and timeout behaviour run in seconds and identical on every run.
+ * Meant for simulation with a single task driving the device.
+ * Scheduled events make it a discrete event simulator: advancing the clock runs all events due in between in time order.
+ * Note that FreeRTOS semaphore timeouts are not affected.
+ */
+class VirtualClock : public Clock {
+  public:
+    explicit VirtualClock(const uint32_t startMs = 0);
+
+    uint32_t nowMs() override;
+    void sleepMs(const uint32_t ms) override;
+
+    /**
+     * @brief Moves the clock forward without yielding, running the events due until then
+     */
+    void advance(const uint32_t ms);
+
+    /**
+     * @brief Runs callback when the clock reaches nowMs() + delayMs, events due at the same time run in
+     * scheduling order. Callbacks run in the task advancing the clock, with nowMs() at their due time.
+     */
+    void schedule(const uint32_t delayMs, std::function<void()> callback);
+
+    size_t getPendingEventCount();
+    void clearEvents();
+
+  private:
+    struct ScheduledEvent {
+      uint32_t dueMs;
+      uint32_t sequence;
+      std::function<void()> callback;
+    };
+
+    bool popDueEvent(const uint32_t untilMs, ScheduledEvent& event);
+
+    std::atomic<uint32_t> now;
+    std::vector<ScheduledEvent> events;
+    uint32_t nextSequence = 0;
+    SemaphoreHandle_t eventSemaphore = xSemaphoreCreateMutex();
+};
+
+} // namespace Nuki
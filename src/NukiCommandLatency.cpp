@@ -0,0 +1,159 @@
+/**
+ * @file NukiCommandLatency.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiCommandLatency.h"
+
+namespace Nuki {
+
+uint8_t LatencyHistogram::bucketIndex(const uint32_t valueMs) {
+  if (valueMs < 4) {
+    return valueMs;
+  }
+  uint8_t octave = 31 - __builtin_clz(valueMs);
+  uint8_t sub = (valueMs >> (octave - 2)) & 0x03;
+  uint32_t index = 4 * (octave - 1) + sub;
+  return index < BUCKET_COUNT ? index : BUCKET_COUNT - 1;
+}
+
+uint32_t LatencyHistogram::bucketUpperBound(const uint8_t index) {
+  if (index < 4) {
+    return index;
+  }
+  uint8_t octave = index / 4 + 1;
+  uint8_t sub = index % 4;
+  uint32_t lower = (uint32_t)(4 + sub) << (octave - 2);
+  return lower + (1UL << (octave - 2)) - 1;
+}
+
+void LatencyHistogram::record(const uint32_t valueMs) {
+  counts[bucketIndex(valueMs)]++;
+  count++;
+  if (valueMs > maxMs) {
+    maxMs = valueMs;
+  }
+}
+
+void LatencyHistogram::reset() {
+  memset(counts, 0, sizeof(counts));
+  count = 0;
+  maxMs = 0;
+}
+
+uint32_t LatencyHistogram::getCount() const {
+  return count;
+}
+
+uint32_t LatencyHistogram::percentile(const uint8_t percent) const {
+  uint32_t rank = ((uint64_t)count * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < BUCKET_COUNT; i++) {
+    seen += counts[i];
+    if (seen >= rank && seen > 0) {
+      uint32_t upper = bucketUpperBound(i);
+      return upper < maxMs ? upper : maxMs;
+    }
+  }
+  return maxMs;
+}
+
+LatencyPercentiles LatencyHistogram::getPercentiles() const {
+  LatencyPercentiles percentiles;
+  percentiles.count = count;
+  percentiles.p50Ms = percentile(50);
+  percentiles.p95Ms = percentile(95);
+  percentiles.p99Ms = percentile(99);
+  percentiles.maxMs = maxMs;
+  return percentiles;
+}
+
+void CommandLatencyTable::record(const Command command, const uint32_t valueMs) {
+  portENTER_CRITICAL(&mux);
+  Entry* freeEntry = nullptr;
+  for (Entry& entry : entries) {
+    if (entry.used && entry.command == command) {
+      entry.histogram.record(valueMs);
+      portEXIT_CRITICAL(&mux);
+      return;
+    }
+    if (!entry.used && freeEntry == nullptr) {
+      freeEntry = &entry;
+    }
+  }
+  if (freeEntry != nullptr) {
+    freeEntry->used = true;
+    freeEntry->command = command;
+    freeEntry->histogram.record(valueMs);
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+bool CommandLatencyTable::getPercentiles(const Command command, LatencyPercentiles* percentiles) const {
+  LatencyHistogram histogram;
+  bool found = false;
+  portENTER_CRITICAL(&mux);
+  for (const Entry& entry : entries) {
+    if (entry.used && entry.command == command) {
+      histogram = entry.histogram;
+      found = true;
+      break;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+
+  if (found) {
+    *percentiles = histogram.getPercentiles();
+  }
+  return found;
+}
+
+void CommandLatencyTable::reset() {
+  portENTER_CRITICAL(&mux);
+  for (Entry& entry : entries) {
+    entry.used = false;
+    entry.command = Command::Empty;
+    entry.histogram.reset();
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+thread_local CommandTimingScope* CommandTimingScope::current = nullptr;
+
+CommandTimingScope::CommandTimingScope()
+  : outer(current) {
+  memset(&timing, 0, sizeof(timing));
+  current = this;
+}
+
+CommandTimingScope::~CommandTimingScope() {
+  current = outer;
+}
+
+const CommandTiming& CommandTimingScope::getTiming() const {
+  return timing;
+}
+
+uint8_t CommandTimingScope::getCommandCount() const {
+  return commandCount;
+}
+
+void CommandTimingScope::record(const CommandTiming& commandTiming) {
+  CommandTimingScope* scope = current;
+  if (scope == nullptr) {
+    return;
+  }
+  scope->timing = commandTiming;
+  if (scope->commandCount < UINT8_MAX) {
+    scope->commandCount++;
+  }
+}
+
+} // namespace Nuki
@@ -0,0 +1,117 @@
+#pragma once
+/**
+ * @file NukiCommandLatency.h
+ * Fixed size latency histograms per command type
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include "NukiDataTypes.h"
+
+#ifndef NUKI_LATENCY_COMMAND_SLOTS
+#define NUKI_LATENCY_COMMAND_SLOTS 16
+#endif
+
+namespace Nuki {
+
+/**
+ * @brief Log-linear histogram of millisecond values, 4 buckets per power of 2 (max 25% error)
+ * covering 0 ms up to ~131 s in 64 buckets. Not thread safe, see CommandLatencyTable.
+ */
+class LatencyHistogram {
+  public:
+    static const uint8_t BUCKET_COUNT = 64;
+
+    void record(const uint32_t valueMs);
+    void reset();
+    uint32_t getCount() const;
+
+    /**
+     * @brief Returns the p50/p95/p99 (upper bound of the bucket holding the percentile) and max value
+     */
+    LatencyPercentiles getPercentiles() const;
+
+    static uint8_t bucketIndex(const uint32_t valueMs);
+    static uint32_t bucketUpperBound(const uint8_t index);
+
+  private:
+    uint32_t percentile(const uint8_t percent) const;
+
+    uint32_t counts[BUCKET_COUNT] = {0};
+    uint32_t count = 0;
+    uint32_t maxMs = 0;
+};
+
+/**
+ * @brief Latency histograms for up to NUKI_LATENCY_COMMAND_SLOTS command types, slots are assigned on first
+ * use. Recording and reading are guarded by a short critical section.
+ */
+class CommandLatencyTable {
+  public:
+    void record(const Command command, const uint32_t valueMs);
+
+    /**
+     * @brief Copies the percentiles of command into percentiles
+     *
+     * @return false if no latency has been recorded for command
+     */
+    bool getPercentiles(const Command command, LatencyPercentiles* percentiles) const;
+    void reset();
+
+  private:
+    struct Entry {
+      bool used = false;
+      Command command = Command::Empty;
+      LatencyHistogram histogram;
+    };
+
+    Entry entries[NUKI_LATENCY_COMMAND_SLOTS];
+    mutable portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+/**
+ * @brief Captures the phase timing of the commands executed by the current task while the scope exists, so
+ * concurrent callers each get the timing of their own call. Only the innermost scope of a task records.
+ *
+ *     Nuki::CommandTimingScope timing;
+ *     Nuki::CmdResult result = nukiLock.lockAction(NukiLock::LockAction::Unlock);
+ *     log_d("%d: %d us", (int)result, timing.getTiming().totalUs);
+ */
+class CommandTimingScope {
+  public:
+    CommandTimingScope();
+    ~CommandTimingScope();
+
+    CommandTimingScope(const CommandTimingScope&) = delete;
+    CommandTimingScope& operator=(const CommandTimingScope&) = delete;
+
+    /**
+     * @brief Timing of the last command finished within the scope, reachedPhases is 0 if none finished
+     */
+    const CommandTiming& getTiming() const;
+
+    /**
+     * @brief Number of commands finished within the scope, more than one if a call was retried
+     */
+    uint8_t getCommandCount() const;
+
+    /**
+     * @brief Stores timing in the innermost scope of the calling task, if any
+     */
+    static void record(const CommandTiming& timing);
+
+  private:
+    CommandTiming timing;
+    uint8_t commandCount = 0;
+    CommandTimingScope* outer;
+    static thread_local CommandTimingScope* current;
+};
+
+} // namespace Nuki
@@ -0,0 +1,131 @@
+#pragma once
+/**
+ * @file NukiConfigTransaction.h
+ * Batched read-modify-write of the (advanced) config of a Nuki device
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include <string.h>
+#include "NukiDataTypes.h"
+
+namespace Nuki {
+
+/**
+ * @brief Collects edits of Config and AdvancedConfig and writes them with at most one SetConfig and one
+ * SetAdvancedConfig command. Each config is only requested from the device on first access and is not
+ * written at all when the edits did not change it.
+ *
+ *        auto transaction = nukiLock.beginConfigTransaction();
+ *        transaction.config().ledBrightness = 3;
+ *        transaction.config().buttonEnabled = true;
+ *        transaction.advancedConfig().autoLockEnabled = true;
+ *        Nuki::CmdResult result = transaction.commit();
+ *
+ * @tparam TDevice NukiLock or NukiOpener
+ * @tparam TConfig config type of the device
+ * @tparam TAdvancedConfig advanced config type of the device
+ */
+template <typename TDevice, typename TConfig, typename TAdvancedConfig>
+class ConfigTransaction {
+  public:
+    explicit ConfigTransaction(TDevice& device)
+      : device(device) {}
+
+    /**
+     * @brief Returns the config to be edited, requests it from the device on first call.
+     * If the request fails the returned config is empty and commit() returns the error
+     */
+    TConfig& config() {
+      if (!configLoaded) {
+        configResult = device.requestConfig(&originalConfig);
+        editedConfig = originalConfig;
+        configLoaded = true;
+      }
+      return editedConfig;
+    }
+
+    /**
+     * @brief Returns the advanced config to be edited, requests it from the device on first call.
+     * If the request fails the returned config is empty and commit() returns the error
+     */
+    TAdvancedConfig& advancedConfig() {
+      if (!advancedConfigLoaded) {
+        advancedConfigResult = device.requestAdvancedConfig(&originalAdvancedConfig);
+        editedAdvancedConfig = originalAdvancedConfig;
+        advancedConfigLoaded = true;
+      }
+      return editedAdvancedConfig;
+    }
+
+    /**
+     * @brief Returns true if commit() would write anything to the device
+     */
+    bool hasChanges() const {
+      return configChanged() || advancedConfigChanged();
+    }
+
+    /**
+     * @brief Writes the changed configs to the device, unchanged configs are skipped.
+     * Can be called again after further edits, only the new changes are written
+     *
+     * @return Success if all changes are written or there was nothing to write, otherwise the
+     * result of the failing request or write
+     */
+    Nuki::CmdResult commit() {
+      if (configLoaded && configResult != Nuki::CmdResult::Success) {
+        return configResult;
+      }
+      if (advancedConfigLoaded && advancedConfigResult != Nuki::CmdResult::Success) {
+        return advancedConfigResult;
+      }
+
+      if (configChanged()) {
+        Nuki::CmdResult result = device.setFromConfig(editedConfig);
+        if (result != Nuki::CmdResult::Success) {
+          return result;
+        }
+        originalConfig = editedConfig;
+      }
+
+      if (advancedConfigChanged()) {
+        Nuki::CmdResult result = device.setFromAdvancedConfig(editedAdvancedConfig);
+        if (result != Nuki::CmdResult::Success) {
+          return result;
+        }
+        originalAdvancedConfig = editedAdvancedConfig;
+      }
+      return Nuki::CmdResult::Success;
+    }
+
+  private:
+    bool configChanged() const {
+      return configLoaded && configResult == Nuki::CmdResult::Success
+             && memcmp(&originalConfig, &editedConfig, sizeof(TConfig)) != 0;
+    }
+
+    bool advancedConfigChanged() const {
+      return advancedConfigLoaded && advancedConfigResult == Nuki::CmdResult::Success
+             && memcmp(&originalAdvancedConfig, &editedAdvancedConfig, sizeof(TAdvancedConfig)) != 0;
+    }
+
+    TDevice& device;
+
+    bool configLoaded = false;
+    Nuki::CmdResult configResult = Nuki::CmdResult::Failed;
+    TConfig originalConfig {};
+    TConfig editedConfig {};
+
+    bool advancedConfigLoaded = false;
+    Nuki::CmdResult advancedConfigResult = Nuki::CmdResult::Failed;
+    TAdvancedConfig originalAdvancedConfig {};
+    TAdvancedConfig editedAdvancedConfig {};
+};
+
+} // namespace Nuki
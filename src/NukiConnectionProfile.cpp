@@ -0,0 +1,58 @@
+/**
+ * @file NukiConnectionProfile.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiConnectionProfile.h"
+
+namespace Nuki {
+
+thread_local ConnectionProfileScope* ConnectionProfileScope::innermost = nullptr;
+
+const char* connectionProfileName(const ConnectionProfile profile) {
+  switch (profile) {
+    case ConnectionProfile::Default:
+      return "default";
+    case ConnectionProfile::Bulk:
+      return "bulk";
+    case ConnectionProfile::Idle:
+      return "idle";
+    default:
+      return "unknown";
+  }
+}
+
+ConnectionParameters defaultConnectionParameters(const ConnectionProfile profile) {
+  switch (profile) {
+    case ConnectionProfile::Bulk:
+      return {6, 12, 0, 400, 247};
+    case ConnectionProfile::Idle:
+      return {80, 160, 4, 600, 0};
+    default:
+      return {24, 40, 0, 400, 0};
+  }
+}
+
+ConnectionProfileScope::ConnectionProfileScope(const ConnectionProfile profile)
+  : profile(profile),
+    outer(innermost) {
+  innermost = this;
+}
+
+ConnectionProfileScope::~ConnectionProfileScope() {
+  innermost = outer;
+}
+
+ConnectionProfile ConnectionProfileScope::current() {
+  ConnectionProfileScope* scope = innermost;
+  return scope != nullptr ? scope->profile : ConnectionProfile::Default;
+}
+
+} // namespace Nuki
@@ -0,0 +1,83 @@
+#pragma once
+/**
+ * @file NukiConnectionProfile.h
+ * BLE connection parameters and ATT MTU per kind of operation
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+
+#ifndef NUKI_IDLE_PROFILE_DELAY
+#define NUKI_IDLE_PROFILE_DELAY 1000
+#endif
+
+namespace Nuki {
+
+enum class ConnectionProfile : uint8_t {
+  Default = 0,                      //single commands
+  Bulk    = 1,                      //log, keypad code and authorization downloads
+  Idle    = 2                       //connected session without traffic
+};
+
+const uint8_t CONNECTION_PROFILE_COUNT = 3;
+
+const char* connectionProfileName(const ConnectionProfile profile);
+
+struct ConnectionParameters {
+  uint16_t minInterval;             //connection interval, units of 1.25 ms
+  uint16_t maxInterval;
+  uint16_t latency;                 //connection events the lock may skip
+  uint16_t supervisionTimeout;      //units of 10 ms
+  uint16_t mtu;                     //minimum ATT MTU expected, negotiated with NimBLEDevice::setMTU() of the application, 0 = any
+};
+
+/**
+ * @brief Default: NimBLE defaults (30-50 ms). Bulk: 7.5-15 ms, MTU 247. Idle: 100-200 ms, slave latency 4.
+ */
+ConnectionParameters defaultConnectionParameters(const ConnectionProfile profile);
+
+struct ConnectionProfileStats {
+  uint32_t sessions;                //connections opened with or switched to this profile
+  uint16_t mtu;                     //ATT MTU of the last session
+  uint16_t connInterval;            //connection interval of the last session (units of 1.25 ms), requested value for switches
+  uint32_t messagesReceived;        //messages received while the profile was active
+  uint32_t transferMs;              //time from entering the profile to the last message received with it
+};
+
+/**
+ * @brief Selects the connection profile used by all library calls made by the current task while the scope exists,
+ * the innermost scope wins. Bulk downloads (retrieveLogEntries(), retrieveKeypadEntries(),
+ * retrieveAuthorizationEntries()) always use ConnectionProfile::Bulk, tune it with NukiBle::setConnectionParameters().
+ *
+ *     {
+ *       Nuki::ConnectionProfileScope profile(Nuki::ConnectionProfile::Bulk);
+ *       nukiLock.requestConfig(&config);
+ *     }
+ */
+class ConnectionProfileScope {
+  public:
+    explicit ConnectionProfileScope(const ConnectionProfile profile);
+    ~ConnectionProfileScope();
+
+    ConnectionProfileScope(const ConnectionProfileScope&) = delete;
+    ConnectionProfileScope& operator=(const ConnectionProfileScope&) = delete;
+
+    /**
+     * @brief Profile of the innermost scope of the calling task, ConnectionProfile::Default if no scope is active
+     */
+    static ConnectionProfile current();
+
+  private:
+    ConnectionProfile profile;
+    ConnectionProfileScope* outer;
+    static thread_local ConnectionProfileScope* innermost;
+};
+
+} // namespace Nuki
@@ -17,14 +17,144 @@
 
 namespace Nuki {
 
-enum class EventType {
-  KeyTurnerStatusUpdated
+enum class EventType : uint8_t {
+  KeyTurnerStatusUpdated  = 0,
+  LockStateChanged        = 1,
+  DoorSensorStateChanged  = 2,
+  BatteryCritical         = 3,
+  NewLogEntry             = 4,
+  KeypadAction            = 5,
+  OpenerRing              = 6,
+  ConnectionUp            = 7,
+  ConnectionDown          = 8,
+  StateFieldChanged       = 9
+};
+
+enum class StateField : uint8_t {
+  NukiState                       = 0,
+  LockState                       = 1,
+  Trigger                         = 2,
+  TimeZoneOffset                  = 3,
+  CriticalBatteryState            = 4,
+  BatteryCritical                 = 5,
+  BatteryCharging                 = 6,
+  BatteryPercentage               = 7,
+  ConfigUpdateCount               = 8,
+  LockNgoTimer                    = 9,
+  RingToOpenTimer                 = 10,
+  LastLockAction                  = 11,
+  LastLockActionTrigger           = 12,
+  LastLockActionCompletionStatus  = 13,
+  DoorSensorState                 = 14,
+  NightModeActive                 = 15,
+  AccessoryBatteryState           = 16
+};
+
+/**
+ * @brief Returns the subscription filter bit for an event type, filters can be combined with |
+ */
+inline constexpr uint32_t eventMask(const EventType eventType) {
+  return 1UL << (uint8_t)eventType;
+}
+
+const uint32_t ALL_EVENTS = 0xFFFFFFFF;
+
+struct StateChange {
+  uint8_t previous;
+  uint8_t current;
+};
+
+struct BatteryStatus {
+  uint8_t criticalBatteryState;
+  uint8_t percentage;
+};
+
+struct NewLogEntryInfo {
+  uint32_t index;
+  uint8_t loggingType;
+};
+
+struct FieldChange {
+  StateField field;
+  int32_t previous;
+  int32_t current;
+};
+
+struct KeypadActionInfo {
+  uint8_t source;
+  uint32_t code;
+  uint8_t action;
+};
+
+struct Event {
+  EventType type;
+  uint32_t timestamp;   //millis() when the event was raised
+  union {
+    StateChange stateChange;        //LockStateChanged, DoorSensorStateChanged (raw enum values)
+    BatteryStatus battery;          //BatteryCritical
+    NewLogEntryInfo logEntry;       //NewLogEntry, OpenerRing
+    KeypadActionInfo keypadAction;  //KeypadAction
+    FieldChange fieldChange;        //StateFieldChanged
+    int rssi;                       //KeyTurnerStatusUpdated
+  };
 };
 
 class SmartlockEventHandler {
   public:
     virtual ~SmartlockEventHandler() {};
-    virtual void notify(EventType eventType) = 0;
+
+    /**
+     * @brief Called for every event matching the subscription filter, by default only
+     * forwards the event type to notify(EventType)
+     */
+    virtual void notify(const Event& event) {
+      notify(event.type);
+    };
+    virtual void notify(EventType eventType) {};
+};
+
+enum class NotificationSource : uint8_t;
+
+/**
+ * @brief Observes plaintext messages before they are encrypted and written to the device,
+ * used to replay traces and to simulate the BLE link without a device
+ */
+class MessageTap {
+  public:
+    virtual ~MessageTap() {};
+
+    /**
+     * @brief Called for every message to be sent, CRC included. USDIO plaintext starts with the authorization id
+     *
+     * @return true if the message is consumed by the tap and must not be sent over BLE, a message not consumed by
+     * a tap that simulatesLink() is not sent at all
+     */
+    virtual bool onSendMessage(const NotificationSource characteristic, const uint8_t* plaintext, const uint16_t length) = 0;
+
+    /**
+     * @brief True if the tap models the BLE link (LinkSimulator). Only then the device does not use the radio,
+     * connectBle() asks isLinkConnected() / onConnectAttempt() instead. Observing taps leave the real link untouched.
+     */
+    virtual bool simulatesLink() {
+      return false;
+    }
+
+    /**
+     * @brief Replaces the BLE connection state if simulatesLink()
+     */
+    virtual bool isLinkConnected() {
+      return true;
+    }
+
+    /**
+     * @brief Called by connectBle() instead of the BLE connect for every connection attempt if simulatesLink(),
+     * retries, backoff and advertisement synchronisation stay with the device
+     *
+     * @return true if the attempt succeeded
+     */
+    virtual bool onConnectAttempt() {
+      return true;
+    }
 };
 
 enum CmdResult : uint8_t {
@@ -34,6 +164,7 @@ enum CmdResult : uint8_t {
   Working   = 4,
   NotPaired = 5,
   Lock_Busy = 6,
+  DeadlineExceeded = 7,
   Error     = 99
 };
 
@@ -68,5 +199,58 @@ enum class CommandState {
   TimeOut               = 6
 };
 
+enum class NotificationSource : uint8_t {
+  Gdio  = 0,
+  Usdio = 1
+};
+
+struct AdvertisementState {
+  int rssi;
+  uint32_t lastReceivedBeaconTs;
+  uint32_t lastHeartbeat;
+};
+
+struct NotificationQueueStats {
+  uint32_t depth;
+  uint32_t capacity;
+  uint32_t highWaterMark;
+  uint32_t overflows;
+  uint32_t oversized;
+  uint32_t processed;
+  uint32_t fragmented;              //messages reassembled from more than one notification
+  uint32_t invalidFrames;           //messages dropped because of an invalid or too large length
+  uint32_t reassemblyTimeouts;      //incomplete messages dropped
+};
+
+enum class CommandPhase : uint8_t {
+  SemaphoreAcquired   = 0,
+  Connected           = 1,  //BLE connection established (skipped when already connected)
+  ServicesDiscovered  = 2,  //registered on the gdio/usdio characteristics (skipped when already connected)
+  ChallengeSent       = 3,
+  ChallengeReceived   = 4,
+  CommandSent         = 5,
+  Accepted            = 6,
+  Completed           = 7
+};
+
+const uint8_t COMMAND_PHASE_COUNT = 8;
+
+struct CommandTiming {
+  Command command;
+  CmdResult result;
+  uint8_t connectAttempts;
+  uint16_t reachedPhases;                       //bit per CommandPhase
+  uint32_t phaseUs[COMMAND_PHASE_COUNT];        //microseconds since the command was started
+  uint32_t totalUs;
+};
+
+struct LatencyPercentiles {
+  uint32_t count;
+  uint32_t p50Ms;
+  uint32_t p95Ms;
+  uint32_t p99Ms;
+  uint32_t maxMs;
+};
+
 
 } // namespace Nuki
@@ -0,0 +1,50 @@
+/**
+ * @file NukiDeadline.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiDeadline.h"
+
+namespace Nuki {
+
+thread_local DeadlineScope* DeadlineScope::current = nullptr;
+
+DeadlineScope::DeadlineScope(Clock* clock, const uint32_t budgetMs)
+  : clock(clock),
+    deadlineMs(clock->nowMs() + budgetMs),
+    outer(current) {
+  if (outer != nullptr && remainingMs() < budgetMs) {
+    deadlineMs = clock->nowMs() + remainingMs();
+  }
+  current = this;
+}
+
+DeadlineScope::~DeadlineScope() {
+  current = outer;
+}
+
+uint32_t DeadlineScope::getDeadlineMs() const {
+  return deadlineMs;
+}
+
+uint32_t DeadlineScope::remainingMs() {
+  DeadlineScope* scope = current;
+  if (scope == nullptr) {
+    return UINT32_MAX;
+  }
+  int32_t remaining = (int32_t)(scope->deadlineMs - scope->clock->nowMs());
+  return remaining > 0 ? remaining : 0;
+}
+
+bool DeadlineScope::expired() {
+  return current != nullptr && remainingMs() == 0;
+}
+
+} // namespace Nuki
@@ -0,0 +1,67 @@
+#pragma once
+/**
+ * @file NukiDeadline.h
+ * Per call deadline honoured by command execution
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiClock.h"
+
+namespace Nuki {
+
+/**
+ * @brief Sets a deadline for all library calls made by the current task while the scope exists.
+ *
+ * The deadline bounds the whole command: waiting for the BLE semaphore or a coalesced request, connecting
+ * (no connect retry is started without budget left), challenge, accept and complete. A call that runs out of
+ * budget returns CmdResult::DeadlineExceeded. Nested scopes can only shorten the deadline of the outer scope.
+ *
+ *     {
+ *       Nuki::DeadlineScope deadline(nukiLock.getClock(), 2000);
+ *       nukiLock.lockAction(NukiLock::LockAction::Unlock);
+ *     }
+ */
+class DeadlineScope {
+  public:
+    /**
+     * @param clock clock of the device the calls are made on
+     * @param budgetMs time from now until the deadline
+     */
+    DeadlineScope(Clock* clock, const uint32_t budgetMs);
+    ~DeadlineScope();
+
+    DeadlineScope(const DeadlineScope&) = delete;
+    DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+    /**
+     * @brief Absolute deadline in clock->nowMs() time
+     */
+    uint32_t getDeadlineMs() const;
+
+    /**
+     * @brief Remaining budget of the innermost scope of the calling task
+     *
+     * @return remaining ms, 0 if the deadline passed, UINT32_MAX if no scope is active
+     */
+    static uint32_t remainingMs();
+
+    /**
+     * @brief True if a scope is active in the calling task and its deadline passed
+     */
+    static bool expired();
+
+  private:
+    Clock* clock;
+    uint32_t deadlineMs;
+    DeadlineScope* outer;
+    static thread_local DeadlineScope* current;
+};
+
+} // namespace Nuki
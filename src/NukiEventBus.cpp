@@ -0,0 +1,184 @@
+/**
+ * @file NukiEventBus.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiEventBus.h"
+
+namespace Nuki {
+
+EventBus::EventBus() {
+}
+
+EventBus::~EventBus() {
+  stopping = true;
+  //the dispatch task finishes the handler it is notifying and deletes itself
+  TaskHandle_t taskHandle = dispatchTaskHandle;
+  if (taskHandle != nullptr) {
+    xTaskNotifyGive(taskHandle);
+    while (dispatchTaskHandle != nullptr) {
+      vTaskDelay(1);
+    }
+  }
+}
+
+bool EventBus::subscribe(SmartlockEventHandler* handler, const uint32_t eventMask) {
+  Subscription subscription;
+  subscription.handler = handler;
+  subscription.eventMask = eventMask;
+  return addSubscription(subscription, true) >= 0;
+}
+
+uint8_t EventBus::addWatch(SmartlockEventHandler* handler, const StateField field, StateWatchPredicate predicate) {
+  Subscription subscription;
+  subscription.handler = handler;
+  subscription.eventMask = eventMask(EventType::StateFieldChanged);
+  subscription.isWatch = true;
+  subscription.field = field;
+  subscription.predicate = predicate;
+  return addSubscription(subscription, false) + 1;
+}
+
+int EventBus::addSubscription(const Subscription& newSubscription, const bool replaceExisting) {
+  int index = -1;
+  xSemaphoreTake(subscriptionSemaphore, portMAX_DELAY);
+  if (replaceExisting) {
+    for (int i = 0; i < NUKI_EVENT_MAX_SUBSCRIBERS; i++) {
+      if (subscriptions[i].handler == newSubscription.handler && !subscriptions[i].isWatch) {
+        index = i;
+        break;
+      }
+    }
+  }
+  if (index < 0) {
+    for (int i = 0; i < NUKI_EVENT_MAX_SUBSCRIBERS; i++) {
+      if (subscriptions[i].handler == nullptr) {
+        index = i;
+        break;
+      }
+    }
+  }
+
+  if (index >= 0) {
+    subscriptions[index] = newSubscription;
+    //the dispatch task has to exist before publish() sees a subscriber in the mask
+    if (dispatchTaskHandle == nullptr && !stopping) {
+      TaskHandle_t taskHandle = nullptr;
+      if (xTaskCreatePinnedToCore(&EventBus::dispatchTask, "nukiEvents", NUKI_EVENT_TASK_STACK_SIZE, this,
+                                  NUKI_EVENT_TASK_PRIORITY, &taskHandle, tskNO_AFFINITY) == pdPASS) {
+        dispatchTaskHandle = taskHandle;
+      } else {
+        log_w("Unable to start event dispatch task");
+      }
+    }
+    updateSubscribedMask();
+  }
+  xSemaphoreGive(subscriptionSemaphore);
+
+  if (index < 0) {
+    log_w("Max nr of event subscribers reached");
+  }
+  return index;
+}
+
+void EventBus::removeWatch(const uint8_t watchId) {
+  if (watchId == 0 || watchId > NUKI_EVENT_MAX_SUBSCRIBERS) {
+    return;
+  }
+  xSemaphoreTake(subscriptionSemaphore, portMAX_DELAY);
+  if (subscriptions[watchId - 1].isWatch) {
+    subscriptions[watchId - 1] = Subscription();
+    updateSubscribedMask();
+  }
+  xSemaphoreGive(subscriptionSemaphore);
+}
+
+void EventBus::unsubscribe(SmartlockEventHandler* handler) {
+  xSemaphoreTake(subscriptionSemaphore, portMAX_DELAY);
+  for (auto& subscription : subscriptions) {
+    if (subscription.handler == handler) {
+      subscription = Subscription();
+    }
+  }
+  updateSubscribedMask();
+  xSemaphoreGive(subscriptionSemaphore);
+}
+
+void EventBus::updateSubscribedMask() {
+  uint32_t mask = 0;
+  for (const auto& subscription : subscriptions) {
+    if (subscription.handler != nullptr) {
+      mask |= subscription.eventMask;
+    }
+  }
+  subscribedMask = mask;
+}
+
+bool EventBus::hasSubscribers(const EventType eventType) const {
+  return (subscribedMask & eventMask(eventType)) != 0;
+}
+
+bool EventBus::publish(const Event& event) {
+  if (!hasSubscribers(event.type)) {
+    return false;
+  }
+
+  if (!eventQueue.push(event)) {
+    droppedEvents++;
+    return false;
+  }
+  TaskHandle_t taskHandle = dispatchTaskHandle;
+  if (taskHandle != nullptr) {
+    xTaskNotifyGive(taskHandle);
+  }
+  return true;
+}
+
+uint32_t EventBus::getDroppedEventCount() const {
+  return droppedEvents;
+}
+
+void EventBus::dispatchTask(void* pvParameters) {
+  EventBus* eventBus = (EventBus*)pvParameters;
+  while (!eventBus->stopping) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (!eventBus->stopping) {
+      eventBus->dispatch();
+    }
+  }
+  eventBus->dispatchTaskHandle = nullptr;
+  vTaskDelete(NULL);
+}
+
+void EventBus::dispatch() {
+  Event event;
+  while (eventQueue.pop(event)) {
+    xSemaphoreTake(subscriptionSemaphore, portMAX_DELAY);
+    for (const auto& subscription : subscriptions) {
+      if (matches(subscription, event)) {
+        subscription.handler->notify(event);
+      }
+    }
+    xSemaphoreGive(subscriptionSemaphore);
+  }
+}
+
+bool EventBus::matches(const Subscription& subscription, const Event& event) const {
+  if (subscription.handler == nullptr || (subscription.eventMask & eventMask(event.type)) == 0) {
+    return false;
+  }
+  if (subscription.isWatch) {
+    return subscription.field == event.fieldChange.field
+           && (subscription.predicate == nullptr || subscription.predicate(event.fieldChange));
+  }
+  return true;
+}
+
+} // namespace Nuki
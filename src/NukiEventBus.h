@@ -0,0 +1,142 @@
+#pragma once
+/**
+ * @file NukiEventBus.h
+ * Asynchronous delivery of typed events to multiple filtered subscribers
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include "NukiDataTypes.h"
+#include "NukiRingBuffer.h"
+#include <functional>
+
+#ifndef NUKI_EVENT_QUEUE_SIZE
+#define NUKI_EVENT_QUEUE_SIZE 32
+#endif
+#ifndef NUKI_EVENT_MAX_SUBSCRIBERS
+#define NUKI_EVENT_MAX_SUBSCRIBERS 4
+#endif
+#ifndef NUKI_EVENT_TASK_STACK_SIZE
+#define NUKI_EVENT_TASK_STACK_SIZE 4096
+#endif
+#ifndef NUKI_EVENT_TASK_PRIORITY
+#define NUKI_EVENT_TASK_PRIORITY 1
+#endif
+
+namespace Nuki {
+
+typedef std::function<bool(const FieldChange& change)> StateWatchPredicate;
+
+/**
+ * @brief Predicate matching changes of a field to a value below threshold (e.g. battery percentage)
+ */
+inline StateWatchPredicate valueBelow(const int32_t threshold) {
+  return [threshold](const FieldChange & change) {
+    return change.current < threshold;
+  };
+}
+
+/**
+ * @brief Predicate matching changes of a field to a value above threshold
+ */
+inline StateWatchPredicate valueAbove(const int32_t threshold) {
+  return [threshold](const FieldChange & change) {
+    return change.current > threshold;
+  };
+}
+
+/**
+ * @brief Predicate matching changes of a field to the given value
+ */
+inline StateWatchPredicate valueEquals(const int32_t value) {
+  return [value](const FieldChange & change) {
+    return change.current == value;
+  };
+}
+
+class EventBus {
+  public:
+    EventBus();
+    virtual ~EventBus();
+
+    /**
+     * @brief Registers a handler for all events matching the filter. The dispatch task is started
+     * on the first subscription, handlers are called from that task and not from the BLE or scanner task.
+     * Handlers must not (un)subscribe from within notify().
+     *
+     * @param handler handler to be called
+     * @param eventMask combination of eventMask() values, ALL_EVENTS for everything
+     * @return false if the maximum nr of subscribers (NUKI_EVENT_MAX_SUBSCRIBERS) is reached
+     */
+    bool subscribe(SmartlockEventHandler* handler, const uint32_t eventMask = ALL_EVENTS);
+
+    /**
+     * @brief Registers a watch on a single state field, the handler receives StateFieldChanged events
+     * for that field for which the predicate returns true. The predicate is evaluated in the event task.
+     *
+     * @param handler handler to be called
+     * @param field state field to watch
+     * @param predicate filter on the change, nullptr matches every change of the field
+     * @return watch id (> 0) to be used with removeWatch(), 0 if the maximum nr of subscribers is reached
+     */
+    uint8_t addWatch(SmartlockEventHandler* handler, const StateField field, StateWatchPredicate predicate = nullptr);
+
+    /**
+     * @brief Removes a watch added with addWatch()
+     */
+    void removeWatch(const uint8_t watchId);
+
+    /**
+     * @brief Removes all subscriptions and watches of handler
+     */
+    void unsubscribe(SmartlockEventHandler* handler);
+
+    /**
+     * @brief Returns true if any subscriber is interested in events of eventType
+     */
+    bool hasSubscribers(const EventType eventType) const;
+
+    /**
+     * @brief Queues the event for delivery, never blocks
+     *
+     * @return false if there are no subscribers or the queue is full
+     */
+    bool publish(const Event& event);
+
+    /**
+     * @brief Returns the nr of events dropped because the queue was full
+     */
+    uint32_t getDroppedEventCount() const;
+
+  private:
+    struct Subscription {
+      SmartlockEventHandler* handler = nullptr;
+      uint32_t eventMask = 0;
+      bool isWatch = false;
+      StateField field = StateField::NukiState;
+      StateWatchPredicate predicate = nullptr;
+    };
+
+    static void dispatchTask(void* pvParameters);
+    void dispatch();
+    bool matches(const Subscription& subscription, const Event& event) const;
+    int addSubscription(const Subscription& subscription, const bool replaceExisting);
+    void updateSubscribedMask();
+
+    Subscription subscriptions[NUKI_EVENT_MAX_SUBSCRIBERS];
+    std::atomic<uint32_t> subscribedMask{0};
+    SemaphoreHandle_t subscriptionSemaphore = xSemaphoreCreateMutex();
+    MpscRingBuffer<Event, NUKI_EVENT_QUEUE_SIZE> eventQueue;
+    std::atomic<TaskHandle_t> dispatchTaskHandle{nullptr};
+    std::atomic<bool> stopping{false};
+    std::atomic<uint32_t> droppedEvents{0};
+};
+
+} // namespace Nuki
@@ -0,0 +1,124 @@
+/**
+ * @file NukiFrameReassembler.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiFrameReassembler.h"
+
+//nonce (24) + authorization id (4) + length (2)
+#define USDIO_HEADER_SIZE 30
+//mac (16) + authorization id (4) + command (2) + crc (2)
+#define USDIO_MIN_ENCRYPTED_SIZE 24
+
+namespace Nuki {
+
+FrameReassembler::FrameReassembler(const NotificationSource source)
+  : source(source) {
+}
+
+ReassemblyResult FrameReassembler::append(const uint8_t* data, const uint16_t dataLength, const uint32_t nowMs) {
+  if (complete) {
+    length = 0;
+    complete = false;
+  }
+  if (length > 0 && nowMs - firstFragmentMs > NUKI_REASSEMBLY_TIMEOUT) {
+    //start of a new message, the rest of the buffered one got lost
+    stats.timeouts++;
+    length = 0;
+  }
+  if (length == 0) {
+    firstFragmentMs = nowMs;
+    fragments = 0;
+  }
+
+  if (dataLength > sizeof(buffer) - length) {
+    stats.invalid++;
+    length = 0;
+    return ReassemblyResult::Invalid;
+  }
+  memcpy(&buffer[length], data, dataLength);
+  length += dataLength;
+  fragments++;
+
+  uint16_t expected = expectedLength();
+  if (expected == 0) {
+    return ReassemblyResult::Incomplete;
+  }
+  if (expected > sizeof(buffer) || length > expected) {
+    stats.invalid++;
+    length = 0;
+    return ReassemblyResult::Invalid;
+  }
+  if (length < expected) {
+    return ReassemblyResult::Incomplete;
+  }
+
+  complete = true;
+  stats.frames++;
+  if (fragments > 1) {
+    stats.fragmented++;
+  }
+  return ReassemblyResult::Complete;
+}
+
+uint16_t FrameReassembler::expectedLength() const {
+  if (source == NotificationSource::Usdio) {
+    if (length < USDIO_HEADER_SIZE) {
+      return 0;
+    }
+    uint16_t encryptedLength = 0;
+    memcpy(&encryptedLength, &buffer[USDIO_HEADER_SIZE - 2], 2);
+    if (encryptedLength < USDIO_MIN_ENCRYPTED_SIZE) {
+      return UINT16_MAX;
+    }
+    return USDIO_HEADER_SIZE + encryptedLength;
+  }
+
+  //GDIO: command (2) + payload + crc (2)
+  if (length < 2) {
+    return 0;
+  }
+  uint16_t command = 0;
+  memcpy(&command, buffer, 2);
+  switch ((Command)command) {
+    case Command::PublicKey:
+    case Command::Challenge:
+      return 2 + 32 + 2;
+    case Command::AuthorizationId:
+      //authenticator (32) + authorization id (4) + lock id (16) + nonce (32)
+      return 2 + 84 + 2;
+    case Command::Status:
+      return 2 + 1 + 2;
+    case Command::ErrorReport:
+      return 2 + 3 + 2;
+    default:
+      return length;
+  }
+}
+
+const uint8_t* FrameReassembler::getFrame() const {
+  return buffer;
+}
+
+uint16_t FrameReassembler::getLength() const {
+  return length;
+}
+
+ReassemblyStats FrameReassembler::getStats() const {
+  return stats;
+}
+
+void FrameReassembler::reset() {
+  length = 0;
+  complete = false;
+  stats = {};
+}
+
+} // namespace Nuki
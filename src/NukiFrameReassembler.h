@@ -0,0 +1,80 @@
+#pragma once
+/**
+ * @file NukiFrameReassembler.h
+ * Reassembly of messages split over multiple BLE notifications
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include "NukiDataTypes.h"
+#include "NukiConstants.h"
+
+#ifndef NUKI_MAX_FRAME_SIZE
+#define NUKI_MAX_FRAME_SIZE 512
+#endif
+#ifndef NUKI_REASSEMBLY_TIMEOUT
+#define NUKI_REASSEMBLY_TIMEOUT 500
+#endif
+
+namespace Nuki {
+
+enum class ReassemblyResult : uint8_t {
+  Incomplete  = 0,                  //more notifications needed
+  Complete    = 1,                  //getFrame() holds a complete message
+  Invalid     = 2                   //malformed or too large, the buffered data was dropped
+};
+
+struct ReassemblyStats {
+  uint32_t frames;                  //complete messages
+  uint32_t fragmented;              //complete messages received in more than one notification
+  uint32_t invalid;
+  uint32_t timeouts;                //incomplete messages dropped because the next notification came too late
+};
+
+/**
+ * @brief Buffers the notifications of one characteristic until the declared length of the message is reached.
+ *
+ * USDIO messages declare their length in the unencrypted header (nonce 24, authorization id 4, length 2).
+ * GDIO messages have no length field, the lengths of the pairing messages sent by the lock are fixed by the
+ * protocol, other GDIO messages are complete with the first notification.
+ * A partial message not completed within NUKI_REASSEMBLY_TIMEOUT is dropped. Not thread safe, used by the
+ * notification task only.
+ */
+class FrameReassembler {
+  public:
+    explicit FrameReassembler(const NotificationSource source);
+
+    ReassemblyResult append(const uint8_t* data, const uint16_t length, const uint32_t nowMs);
+
+    /**
+     * @brief Complete message, valid after append() returned Complete until the next append()
+     */
+    const uint8_t* getFrame() const;
+    uint16_t getLength() const;
+
+    ReassemblyStats getStats() const;
+    void reset();
+
+  private:
+    /**
+     * @return length of the buffered message, 0 if not known yet
+     */
+    uint16_t expectedLength() const;
+
+    const NotificationSource source;
+    uint8_t buffer[NUKI_MAX_FRAME_SIZE];
+    uint16_t length = 0;
+    uint16_t fragments = 0;
+    bool complete = false;
+    uint32_t firstFragmentMs = 0;
+    ReassemblyStats stats = {};
+};
+
+} // namespace Nuki
@@ -0,0 +1,123 @@
+/**
+ * @file NukiFrameRecorder.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiFrameRecorder.h"
+
+#define PCAP_LINKTYPE_USER0 147
+#define PCAP_PSEUDO_HEADER_SIZE 4
+
+namespace Nuki {
+
+struct __attribute__((packed)) PcapGlobalHeader {
+  uint32_t magicNumber;
+  uint16_t versionMajor;
+  uint16_t versionMinor;
+  int32_t thisZone;
+  uint32_t sigFigs;
+  uint32_t snapLen;
+  uint32_t network;
+};
+
+struct __attribute__((packed)) PcapRecordHeader {
+  uint32_t tsSec;
+  uint32_t tsUsec;
+  uint32_t inclLen;
+  uint32_t origLen;
+};
+
+void FrameRecorder::enable(const bool enable) {
+  enabled = enable;
+}
+
+bool FrameRecorder::isEnabled() const {
+  return enabled;
+}
+
+void FrameRecorder::record(const FrameDirection direction, const NotificationSource characteristic, const uint8_t* data, const uint16_t length) {
+  if (!enabled) {
+    return;
+  }
+  int64_t now = esp_timer_get_time();
+  uint16_t recordLength = length < NUKI_TRACE_FRAME_SIZE ? length : NUKI_TRACE_FRAME_SIZE;
+
+  portENTER_CRITICAL(&mux);
+  TraceFrame& frame = frames[recorded % NUKI_TRACE_FRAMES];
+  frame.timestampUs = now;
+  frame.direction = direction;
+  frame.characteristic = characteristic;
+  frame.length = recordLength;
+  frame.originalLength = length;
+  memcpy(frame.data, data, recordLength);
+  recorded++;
+  portEXIT_CRITICAL(&mux);
+}
+
+uint32_t FrameRecorder::getFrameCount() const {
+  uint32_t count = getRecordedCount();
+  return count < NUKI_TRACE_FRAMES ? count : NUKI_TRACE_FRAMES;
+}
+
+uint32_t FrameRecorder::getRecordedCount() const {
+  portENTER_CRITICAL(&mux);
+  uint32_t count = recorded;
+  portEXIT_CRITICAL(&mux);
+  return count;
+}
+
+void FrameRecorder::clear() {
+  portENTER_CRITICAL(&mux);
+  recorded = 0;
+  portEXIT_CRITICAL(&mux);
+}
+
+size_t FrameRecorder::writePcap(Print& out) const {
+  PcapGlobalHeader globalHeader;
+  globalHeader.magicNumber = 0xa1b2c3d4;
+  globalHeader.versionMajor = 2;
+  globalHeader.versionMinor = 4;
+  globalHeader.thisZone = 0;
+  globalHeader.sigFigs = 0;
+  globalHeader.snapLen = NUKI_TRACE_FRAME_SIZE + PCAP_PSEUDO_HEADER_SIZE;
+  globalHeader.network = PCAP_LINKTYPE_USER0;
+  size_t written = out.write((const uint8_t*)&globalHeader, sizeof(globalHeader));
+
+  uint32_t end = getRecordedCount();
+  uint32_t start = end > NUKI_TRACE_FRAMES ? end - NUKI_TRACE_FRAMES : 0;
+  TraceFrame frame;
+  for (uint32_t i = start; i < end; i++) {
+    portENTER_CRITICAL(&mux);
+    //skip frames overwritten by new recordings while exporting
+    bool valid = recorded - i <= NUKI_TRACE_FRAMES && i < recorded;
+    if (valid) {
+      memcpy(&frame, &frames[i % NUKI_TRACE_FRAMES], sizeof(TraceFrame));
+    }
+    portEXIT_CRITICAL(&mux);
+    if (!valid) {
+      continue;
+    }
+
+    PcapRecordHeader recordHeader;
+    recordHeader.tsSec = frame.timestampUs / 1000000;
+    recordHeader.tsUsec = frame.timestampUs % 1000000;
+    recordHeader.inclLen = frame.length + PCAP_PSEUDO_HEADER_SIZE;
+    recordHeader.origLen = frame.originalLength + PCAP_PSEUDO_HEADER_SIZE;
+    uint8_t pseudoHeader[PCAP_PSEUDO_HEADER_SIZE] = {(uint8_t)frame.direction, (uint8_t)frame.characteristic,
+                                                     (uint8_t)(frame.length < frame.originalLength ? 1 : 0), 0
+                                                    };
+    written += out.write((const uint8_t*)&recordHeader, sizeof(recordHeader));
+    written += out.write(pseudoHeader, sizeof(pseudoHeader));
+    written += out.write(frame.data, frame.length);
+  }
+  return written;
+}
+
+} // namespace Nuki
@@ -0,0 +1,89 @@
+#pragma once
+/**
+ * @file NukiFrameRecorder.h
+ * Ring buffer recorder of sent and received BLE messages with pcap export
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include "NukiDataTypes.h"
+#include <atomic>
+
+#ifndef NUKI_TRACE_FRAMES
+#define NUKI_TRACE_FRAMES 32
+#endif
+#ifndef NUKI_TRACE_FRAME_SIZE
+#define NUKI_TRACE_FRAME_SIZE 128
+#endif
+
+namespace Nuki {
+
+enum class FrameDirection : uint8_t {
+  Tx = 0,
+  Rx = 1
+};
+
+struct TraceFrame {
+  int64_t timestampUs;              //esp_timer_get_time()
+  FrameDirection direction;
+  NotificationSource characteristic;
+  uint16_t length;                  //recorded bytes
+  uint16_t originalLength;          //length of the message, larger than length if truncated
+  uint8_t data[NUKI_TRACE_FRAME_SIZE];
+};
+
+/**
+ * @brief Keeps the last NUKI_TRACE_FRAMES plaintext messages (before encryption / after decryption, CRC included)
+ * in preallocated memory. Recording is a bounded memcpy in a critical section, nothing is logged or printed,
+ * so it can stay enabled in production without changing timing.
+ *
+ * Note that the plaintext of commands with a security pin contains the pin, treat exported traces accordingly.
+ *
+ * Export format is pcap (microsecond timestamps since boot) with link type LINKTYPE_USER0 (147),
+ * every packet starts with a 4 byte pseudo header followed by the plaintext:
+ *  # direction (0 = tx, 1 = rx) # characteristic (0 = GDIO, 1 = USDIO) # flags (bit 0: truncated) # reserved #
+ *  #          1 byte            #                1 byte                #           1 byte           #  1 byte  #
+ * USDIO plaintext starts with the 4 byte authorization id, GDIO plaintext with the command identifier.
+ */
+class FrameRecorder {
+  public:
+    void enable(const bool enable);
+    bool isEnabled() const;
+
+    void record(const FrameDirection direction, const NotificationSource characteristic, const uint8_t* data, const uint16_t length);
+
+    /**
+     * @brief Number of frames currently held (max NUKI_TRACE_FRAMES)
+     */
+    uint32_t getFrameCount() const;
+
+    /**
+     * @brief Number of frames recorded since the last clear, including the ones overwritten
+     */
+    uint32_t getRecordedCount() const;
+
+    void clear();
+
+    /**
+     * @brief Writes all held frames from oldest to newest as pcap file
+     *
+     * @param out destination, e.g. Serial, a File or a WiFiClient
+     * @return number of bytes written
+     */
+    size_t writePcap(Print& out) const;
+
+  private:
+    TraceFrame frames[NUKI_TRACE_FRAMES];
+    uint32_t recorded = 0;
+    std::atomic<bool> enabled{false};
+    mutable portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+} // namespace Nuki
@@ -0,0 +1,475 @@
+/**
+ * @file NukiLinkSimulator.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiLinkSimulator.h"
+#include "NukiUtils.h"
+#include <math.h>
+
+#define SIM_ERROR_LOCK_BUSY 69
+
+namespace Nuki {
+
+LinkSimulator::LinkSimulator(NukiBle* device, VirtualClock* clock)
+  : device(device),
+    clock(clock) {
+}
+
+LinkSimulator::~LinkSimulator() {
+  stop();
+}
+
+bool LinkSimulator::loadScenario(const char* text) {
+  LinkScenario parsed;
+  uint16_t lineNr = 0;
+  const char* line = text;
+  while (line != nullptr && *line != '\0') {
+    const char* end = strchr(line, '\n');
+    size_t length = end != nullptr ? end - line : strlen(line);
+    lineNr++;
+    char buffer[NUKI_SIM_SCENARIO_LINE_SIZE];
+    if (length >= sizeof(buffer)) {
+      log_w("Scenario line %d too long", lineNr);
+      return false;
+    }
+    memcpy(buffer, line, length);
+    buffer[length] = '\0';
+    if (!parseScenarioLine(buffer, parsed)) {
+      log_w("Invalid scenario line %d: %s", lineNr, buffer);
+      return false;
+    }
+    line = end != nullptr ? end + 1 : nullptr;
+  }
+  setScenario(parsed);
+  return true;
+}
+
+bool LinkSimulator::parseScenarioLine(char* line, LinkScenario& scenario) {
+  char* comment = strchr(line, '#');
+  if (comment != nullptr) {
+    *comment = '\0';
+  }
+  char key[24];
+  int valueOffset = 0;
+  if (sscanf(line, " %23s %n", key, &valueOffset) != 1) {
+    return true;  //empty line
+  }
+  const char* value = &line[valueOffset];
+
+  float rate = 0;
+  if (strcmp(key, "seed") == 0) {
+    return sscanf(value, "%u", &scenario.seed) == 1;
+  } else if (strcmp(key, "connect") == 0) {
+    return parseLatency(value, scenario.connect);
+  } else if (strcmp(key, "latency") == 0) {
+    return parseLatency(value, scenario.latency);
+  } else if (strcmp(key, "idle_disconnect_ms") == 0) {
+    return sscanf(value, "%u", &scenario.idleDisconnectMs) == 1;
+  } else if (strcmp(key, "action_ms") == 0) {
+    return sscanf(value, "%u", &scenario.actionMs) == 1;
+  } else if (strcmp(key, "advert_ms") == 0) {
+    return sscanf(value, "%u", &scenario.advertIntervalMs) == 1;
+  } else if (strcmp(key, "rssi") == 0) {
+    return sscanf(value, "%d", &scenario.advertRssi) == 1;
+  } else if (strcmp(key, "conn_events") == 0) {
+    unsigned int enabled = 0;
+    if (sscanf(value, "%u", &enabled) != 1) {
+      return false;
+    }
+    scenario.connectionEvents = enabled != 0;
+    return true;
+  } else if (strcmp(key, "entries") == 0) {
+    return sscanf(value, "%u", &scenario.entries) == 1;
+  } else if (strcmp(key, "response") == 0) {
+    if (scenario.nrOfResponses >= NUKI_SIM_RESPONSES) {
+      return false;
+    }
+    SimulatedResponse& response = scenario.responses[scenario.nrOfResponses];
+    unsigned int request = 0;
+    unsigned int answer = 0;
+    int payloadOffset = 0;
+    if (sscanf(value, "%x %x %n", &request, &answer, &payloadOffset) != 2) {
+      return false;
+    }
+    response.request = (Command)request;
+    response.response = (Command)answer;
+    response.payloadLen = 0;
+    const char* hex = &value[payloadOffset];
+    unsigned int byteValue;
+    while (sscanf(hex, "%2x", &byteValue) == 1) {
+      if (response.payloadLen >= NUKI_SIM_RESPONSE_SIZE) {
+        return false;
+      }
+      response.payload[response.payloadLen++] = byteValue;
+      hex += 2;
+      if (*hex == '\0' || *hex == ' ' || *hex == '\r') {
+        break;
+      }
+    }
+    scenario.nrOfResponses++;
+    return true;
+  } else if (sscanf(value, "%f", &rate) != 1 || rate < 0 || rate > 1) {
+    return false;
+  }
+
+  if (strcmp(key, "connect_fail") == 0) {
+    scenario.connectFailRate = rate;
+  } else if (strcmp(key, "drop") == 0) {
+    scenario.dropRate = rate;
+  } else if (strcmp(key, "corrupt") == 0) {
+    scenario.corruptRate = rate;
+  } else if (strcmp(key, "busy") == 0) {
+    scenario.busyRate = rate;
+  } else if (strcmp(key, "disconnect") == 0) {
+    scenario.disconnectRate = rate;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool LinkSimulator::parseLatency(const char* text, LatencyModel& model) {
+  char distribution[12];
+  unsigned int a = 0;
+  unsigned int b = 0;
+  int count = sscanf(text, "%11s %u %u", distribution, &a, &b);
+  if (count == 2 && strcmp(distribution, "fixed") == 0) {
+    model.distribution = LatencyDistribution::Fixed;
+  } else if (count == 3 && strcmp(distribution, "uniform") == 0 && a <= b) {
+    model.distribution = LatencyDistribution::Uniform;
+  } else if (count == 3 && strcmp(distribution, "normal") == 0) {
+    model.distribution = LatencyDistribution::Normal;
+  } else {
+    return false;
+  }
+  model.a = a;
+  model.b = b;
+  return true;
+}
+
+void LinkSimulator::setScenario(const LinkScenario& newScenario) {
+  scenario = newScenario;
+  randomState = scenario.seed != 0 ? scenario.seed : 1;
+}
+
+const LinkScenario& LinkSimulator::getScenario() const {
+  return scenario;
+}
+
+void LinkSimulator::start() {
+  device->setClock(clock);
+  device->setMessageTap(this);
+  running = true;
+  connected = false;
+  lastActivityMs = clock->nowMs();
+  device->injectAdvertisement(scenario.advertRssi);
+  scheduleAdvertisement();
+}
+
+void LinkSimulator::stop() {
+  if (!running) {
+    return;
+  }
+  running = false;
+  device->setMessageTap(nullptr);
+  clock->clearEvents();
+}
+
+LinkSimulatorStats LinkSimulator::getStats() const {
+  return stats;
+}
+
+void LinkSimulator::resetStats() {
+  stats = {};
+}
+
+uint32_t LinkSimulator::random() {
+  //xorshift32
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+bool LinkSimulator::chance(const float rate) {
+  if (rate <= 0) {
+    return false;
+  }
+  return random() < (uint32_t)(rate * 4294967295.0);
+}
+
+uint32_t LinkSimulator::sampleLatency(const LatencyModel& model) {
+  switch (model.distribution) {
+    case LatencyDistribution::Uniform:
+      return model.a + random() % (model.b - model.a + 1);
+    case LatencyDistribution::Normal: {
+      //Box-Muller
+      float u1 = (random() + 1.0f) / 4294967297.0f;
+      float u2 = random() / 4294967296.0f;
+      float sample = model.a + model.b * sqrtf(-2.0f * logf(u1)) * cosf(2.0f * M_PI * u2);
+      return sample > 0 ? (uint32_t)sample : 0;
+    }
+    default:
+      return model.a;
+  }
+}
+
+void LinkSimulator::scheduleAdvertisement() {
+  if (scenario.advertIntervalMs == 0) {
+    return;
+  }
+  clock->schedule(scenario.advertIntervalMs, [this]() {
+    if (running) {
+      device->injectAdvertisement(scenario.advertRssi);
+      scheduleAdvertisement();
+    }
+  });
+}
+
+bool LinkSimulator::simulatesLink() {
+  return true;
+}
+
+bool LinkSimulator::isLinkConnected() {
+  if (connected && scenario.idleDisconnectMs > 0 && clock->nowMs() - lastActivityMs > scenario.idleDisconnectMs) {
+    disconnect();
+  }
+  return connected;
+}
+
+bool LinkSimulator::onConnectAttempt() {
+  //called from connectBle(), which retries and backs off per the device's RetryPolicy
+  stats.connectAttempts++;
+  clock->sleepMs(sampleLatency(scenario.connect));
+  if (chance(scenario.connectFailRate)) {
+    stats.connectFailures++;
+    return false;
+  }
+  stats.connects++;
+  connected = true;
+  lastActivityMs = clock->nowMs();
+  return true;
+}
+
+void LinkSimulator::disconnect() {
+  connected = false;
+  //notifications still in flight are lost
+  linkEpoch++;
+  stats.disconnects++;
+  device->injectDisconnect();
+}
+
+bool LinkSimulator::onSendMessage(const NotificationSource characteristic, const uint8_t* plaintext, const uint16_t length) {
+  stats.messagesReceived++;
+  if (characteristic != NotificationSource::Usdio) {
+    log_w("Simulator: pairing is not simulated");
+    return true;
+  }
+
+  //connectBle() connected the link before the message is written
+  if (!isLinkConnected()) {
+    stats.messagesLost++;
+    return true;
+  }
+  lastActivityMs = clock->nowMs();
+
+  if (chance(scenario.disconnectRate)) {
+    disconnect();
+    return true;
+  }
+
+  //# authorization id # command # payload # crc #
+  if (length < 8) {
+    return true;
+  }
+  uint16_t command = 0;
+  memcpy(&command, &plaintext[4], 2);
+  respond(plaintext, (Command)command, &plaintext[6], length - 8);
+  return true;
+}
+
+void LinkSimulator::respond(const uint8_t* authorizationId, const Command command, const uint8_t* payload, const uint16_t payloadLen) {
+  Command request = command;
+  if (command == Command::RequestData && payloadLen >= 2) {
+    memcpy(&request, payload, 2);
+  }
+
+  uint32_t delayMs = sampleLatency(scenario.latency);
+  if (request == Command::Challenge) {
+    uint8_t nonce[32];
+    for (uint8_t i = 0; i < sizeof(nonce); i++) {
+      nonce[i] = random();
+    }
+    sendNotification(delayMs, authorizationId, Command::Challenge, nonce, sizeof(nonce));
+    return;
+  }
+
+  if (chance(scenario.busyRate)) {
+    uint8_t error[3] = {SIM_ERROR_LOCK_BUSY, (uint8_t)((uint16_t)request & 0xFF), (uint8_t)((uint16_t)request >> 8)};
+    stats.busyReplies++;
+    sendNotification(delayMs, authorizationId, Command::ErrorReport, error, sizeof(error));
+    return;
+  }
+
+  for (uint8_t i = 0; i < scenario.nrOfResponses; i++) {
+    const SimulatedResponse& response = scenario.responses[i];
+    if (response.request == request) {
+      sendNotification(delayMs, authorizationId, response.response, response.payload, response.payloadLen);
+      return;
+    }
+  }
+
+  uint8_t status = (uint8_t)CommandStatus::Complete;
+  switch (request) {
+    case Command::RequestConfig:
+      sendNotification(delayMs, authorizationId, Command::Config, nullptr, 0);
+      break;
+    case Command::RequestAdvancedConfig:
+      sendNotification(delayMs, authorizationId, Command::AdvancedConfig, nullptr, 0);
+      break;
+    case Command::RequestLogEntries:
+    case Command::RequestAuthorizationEntries:
+    case Command::RequestKeypadCodes:
+      sendEntries(delayMs, authorizationId, request, payload, payloadLen);
+      break;
+    case Command::LockAction:
+    case Command::SimpleLockAction:
+    case Command::KeypadAction:
+    case Command::ContinuousModeAction: {
+      uint8_t accepted = (uint8_t)CommandStatus::Accepted;
+      uint32_t acceptedAt = sendNotification(delayMs, authorizationId, Command::Status, &accepted, 1);
+      sendNotification(acceptedAt + scenario.actionMs + sampleLatency(scenario.latency), authorizationId, Command::Status, &status, 1);
+      break;
+    }
+    default:
+      if (command == Command::RequestData) {
+        sendNotification(delayMs, authorizationId, request, nullptr, 0);
+      } else {
+        sendNotification(delayMs, authorizationId, Command::Status, &status, 1);
+      }
+      break;
+  }
+}
+
+void LinkSimulator::sendEntries(const uint32_t delayMs, const uint8_t* authorizationId, const Command request,
+                                const uint8_t* payload, const uint16_t payloadLen) {
+  //log: start index (4), count (2), sort order (1), total count (1), others: offset (2), count (2)
+  //log indices run from 1 to entries in either sort order, start index 0 is the first entry in sort order
+  uint32_t first = 0;
+  uint16_t count = 0;
+  bool sendCount = true;
+  bool descending = false;
+  Command entryCommand;
+  Command countCommand;
+  if (request == Command::RequestLogEntries && payloadLen >= 8) {
+    memcpy(&first, payload, 4);
+    memcpy(&count, &payload[4], 2);
+    descending = payload[6] != 0;
+    sendCount = payload[7] != 0;
+    entryCommand = Command::LogEntry;
+    countCommand = Command::LogEntryCount;
+    if (descending && (first == 0 || first > scenario.entries)) {
+      first = scenario.entries;
+    } else if (!descending && first == 0) {
+      first = 1;
+    }
+  } else if (request != Command::RequestLogEntries && payloadLen >= 4) {
+    uint16_t offset = 0;
+    memcpy(&offset, payload, 2);
+    memcpy(&count, &payload[2], 2);
+    first = offset;
+    entryCommand = request == Command::RequestKeypadCodes ? Command::KeypadCode : Command::AuthorizationEntry;
+    countCommand = request == Command::RequestKeypadCodes ? Command::KeypadCodeCount : Command::AuthorizationEntryCount;
+  } else {
+    uint8_t status = (uint8_t)CommandStatus::Complete;
+    sendNotification(delayMs, authorizationId, Command::Status, &status, 1);
+    return;
+  }
+
+  //entries available from first on in sort order
+  uint32_t available;
+  if (request == Command::RequestLogEntries) {
+    available = descending ? first : (first > scenario.entries ? 0 : scenario.entries - first + 1);
+  } else {
+    available = first >= scenario.entries ? 0 : scenario.entries - first;
+  }
+  if (count > available) {
+    count = available;
+  }
+
+  uint32_t sentAt = delayMs;
+  if (sendCount) {
+    uint16_t total = scenario.entries;
+    if (request == Command::RequestLogEntries) {
+      //logging enabled, count, door sensor enabled, door sensor logging enabled
+      uint8_t logCount[5] = {1, (uint8_t)total, (uint8_t)(total >> 8), 0, 0};
+      sentAt = sendNotification(sentAt, authorizationId, countCommand, logCount, sizeof(logCount));
+    } else {
+      sentAt = sendNotification(sentAt, authorizationId, countCommand, (uint8_t*)&total, sizeof(total));
+    }
+  }
+  for (uint16_t i = 0; i < count; i++) {
+    uint32_t index = descending ? first - i : first + i;
+    sentAt = sendNotification(sentAt, authorizationId, entryCommand, (uint8_t*)&index, sizeof(index));
+    stats.entriesSent++;
+  }
+  uint8_t status = (uint8_t)CommandStatus::Complete;
+  sendNotification(sentAt, authorizationId, Command::Status, &status, 1);
+}
+
+uint32_t LinkSimulator::sendNotification(const uint32_t delayMs, const uint8_t* authorizationId, const Command command,
+    const uint8_t* payload, const uint8_t payloadLen) {
+  uint32_t dueMs = delayMs;
+  if (scenario.connectionEvents) {
+    //at most one notification per connection event
+    uint32_t nowMs = clock->nowMs();
+    uint32_t intervalMs = device->getConnectionParameters(device->getConnectionProfile()).maxInterval * 5 / 4;
+    if ((int32_t)(nextConnectionEventMs - (nowMs + dueMs)) > 0) {
+      dueMs = nextConnectionEventMs - nowMs;
+    }
+    nextConnectionEventMs = nowMs + dueMs + (intervalMs > 0 ? intervalMs : 1);
+  }
+
+  stats.notificationsSent++;
+  if (chance(scenario.dropRate)) {
+    stats.dropped++;
+    return dueMs;
+  }
+
+  Notification notification;
+  memcpy(&notification.data[0], authorizationId, 4);
+  memcpy(&notification.data[4], &command, 2);
+  if (payloadLen > 0) {
+    memcpy(&notification.data[6], payload, payloadLen);
+  }
+  uint16_t dataCrc = calculateCrc(notification.data, 0, 6 + payloadLen);
+  memcpy(&notification.data[6 + payloadLen], &dataCrc, 2);
+  notification.length = 8 + payloadLen;
+
+  if (chance(scenario.corruptRate)) {
+    notification.data[notification.length - 1] ^= 0xFF;
+    stats.corrupted++;
+  }
+
+  uint32_t epoch = linkEpoch;
+  clock->schedule(dueMs, [this, notification, epoch]() {
+    if (epoch != linkEpoch) {
+      stats.lostOnDisconnect++;
+      return;
+    }
+    lastActivityMs = clock->nowMs();
+    stats.notificationsDelivered++;
+    device->injectReceivedMessage(NotificationSource::Usdio, notification.data, notification.length);
+  });
+  return dueMs;
+}
+
+} // namespace Nuki
@@ -0,0 +1,187 @@
+#pragma once
+/**
+ * @file NukiLinkSimulator.h
+ * Simulated BLE link and lock for NukiLock / NukiOpener with fault injection
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiBle.h"
+#include "NukiClock.h"
+
+#ifndef NUKI_SIM_RESPONSES
+#define NUKI_SIM_RESPONSES 8
+#endif
+#ifndef NUKI_SIM_RESPONSE_SIZE
+#define NUKI_SIM_RESPONSE_SIZE 64
+#endif
+#ifndef NUKI_SIM_SCENARIO_LINE_SIZE
+#define NUKI_SIM_SCENARIO_LINE_SIZE 200
+#endif
+
+namespace Nuki {
+
+enum class LatencyDistribution : uint8_t {
+  Fixed,
+  Uniform,
+  Normal
+};
+
+struct LatencyModel {
+  LatencyDistribution distribution = LatencyDistribution::Fixed;
+  uint32_t a = 0;                   //fixed: latency, uniform: min, normal: mean
+  uint32_t b = 0;                   //uniform: max, normal: standard deviation
+};
+
+struct SimulatedResponse {
+  Command request;
+  Command response;
+  uint8_t payloadLen;
+  uint8_t payload[NUKI_SIM_RESPONSE_SIZE];
+};
+
+struct LinkScenario {
+  uint32_t seed = 1;
+  LatencyModel connect;             //connection establishment, paid by the first message after a disconnect
+  LatencyModel latency;             //per notification from the lock
+  float connectFailRate = 0;        //per connection attempt
+  float dropRate = 0;               //notifications lost
+  float corruptRate = 0;            //notifications delivered with invalid CRC
+  float busyRate = 0;               //commands answered with error 69 (lock busy)
+  float disconnectRate = 0;         //per message, the link drops right after the message is written
+  uint32_t idleDisconnectMs = 0;    //link drops after this time without traffic, 0 = never
+  uint32_t actionMs = 0;            //time between Accepted and Complete of lock actions
+  uint32_t advertIntervalMs = 1000; //0 = no advertisements (heartbeat times out)
+  bool connectionEvents = false;    //notifications only on connection events of the device's connection profile
+  uint32_t entries = 100;           //log, authorization and keypad entries held by the lock
+  int advertRssi = -60;
+  SimulatedResponse responses[NUKI_SIM_RESPONSES];
+  uint8_t nrOfResponses = 0;
+};
+
+struct LinkSimulatorStats {
+  uint32_t messagesReceived;        //messages written by the device
+  uint32_t messagesLost;            //messages written while the link was down
+  uint32_t notificationsSent;
+  uint32_t notificationsDelivered;
+  uint32_t dropped;
+  uint32_t corrupted;
+  uint32_t lostOnDisconnect;        //notifications in flight when the link dropped
+  uint32_t busyReplies;
+  uint32_t entriesSent;             //log, authorization and keypad entries of bulk downloads
+  uint32_t connectAttempts;         //attempts made by connectBle() of the device
+  uint32_t connectFailures;         //failed attempts, retried by connectBle() per the device's RetryPolicy
+  uint32_t connects;
+  uint32_t disconnects;
+};
+
+/**
+ * @brief Discrete event simulation of the BLE link to a lock, driven by a VirtualClock.
+ *
+ * Installed as message tap, the simulator answers the messages sent by the device like a lock would (challenge,
+ * requested data, status accepted / complete, error 69) and delivers the answers through injectReceivedMessage()
+ * after a latency drawn from the scenario, with drops, corrupted CRC and disconnects injected at the configured rates.
+ * Connects go through connectBle() of the device, the simulator only replaces the BLE connect of each attempt, so
+ * the device's RetryPolicy, advertisement synchronisation and connection profiles run as on a real link.
+ * Connection establishment advances the clock in the sending task, like connectBle() blocks on a real link.
+ * All randomness comes from a seeded generator, so a scenario with the same seed runs identical every time.
+ *
+ * The device needs stored credentials (paired), pairing over GDIO is not simulated.
+ *
+ * Scenario text, one setting per line, # starts a comment:
+ *
+ *     seed 42
+ *     connect uniform 300 900          # fixed <ms> | uniform <min> <max> | normal <mean> <stddev>
+ *     latency normal 40 15
+ *     connect_fail 0.1
+ *     drop 0.02
+ *     corrupt 0.01
+ *     busy 0.05
+ *     disconnect 0.01
+ *     idle_disconnect_ms 1000
+ *     action_ms 1500
+ *     advert_ms 1000
+ *     rssi -70
+ *     conn_events 1                    # one notification per connection interval of the active connection profile
+ *     entries 500                      # size of the log, authorization and keypad lists
+ *     response 000c 000c 0a0b0c        # request, response command (hex) and optional payload (hex)
+ *
+ * The request of a response is the command sent by the device, or for RequestData the requested command.
+ * Without a matching response, data requests are answered with the requested command and an empty payload,
+ * lock actions with Accepted and Complete, log, authorization and keypad list requests with the requested
+ * entries (carrying only their index, log indices run from 1 to entries) followed by Complete and all other
+ * commands with Complete.
+ */
+class LinkSimulator : public MessageTap {
+  public:
+    LinkSimulator(NukiBle* device, VirtualClock* clock);
+    ~LinkSimulator();
+
+    /**
+     * @brief Parses scenario text (see class description) and applies it
+     *
+     * @return false on an unknown setting or invalid value, the scenario is left unchanged
+     */
+    bool loadScenario(const char* text);
+
+    void setScenario(const LinkScenario& scenario);
+    const LinkScenario& getScenario() const;
+
+    /**
+     * @brief Sets the virtual clock on the device, installs the simulator as message tap and starts advertising
+     */
+    void start();
+
+    /**
+     * @brief Removes the message tap and drops all scheduled events of the clock
+     */
+    void stop();
+
+    LinkSimulatorStats getStats() const;
+    void resetStats();
+
+    bool onSendMessage(const NotificationSource characteristic, const uint8_t* plaintext, const uint16_t length) override;
+    bool simulatesLink() override;
+    bool isLinkConnected() override;
+    bool onConnectAttempt() override;
+
+  private:
+    struct Notification {
+      uint8_t data[NUKI_SIM_RESPONSE_SIZE + 8];
+      uint16_t length;
+    };
+
+    uint32_t random();
+    bool chance(const float rate);
+    uint32_t sampleLatency(const LatencyModel& model);
+
+    void disconnect();
+    void scheduleAdvertisement();
+    void respond(const uint8_t* authorizationId, const Command command, const uint8_t* payload, const uint16_t payloadLen);
+    void sendEntries(const uint32_t delayMs, const uint8_t* authorizationId, const Command request,
+                     const uint8_t* payload, const uint16_t payloadLen);
+    uint32_t sendNotification(const uint32_t delayMs, const uint8_t* authorizationId, const Command command,
+                              const uint8_t* payload, const uint8_t payloadLen);
+
+    static bool parseScenarioLine(char* line, LinkScenario& scenario);
+    static bool parseLatency(const char* text, LatencyModel& model);
+
+    NukiBle* device;
+    VirtualClock* clock;
+    LinkScenario scenario;
+    LinkSimulatorStats stats = {};
+    uint32_t randomState = 1;
+    bool running = false;
+    bool connected = false;
+    uint32_t linkEpoch = 0;
+    uint32_t lastActivityMs = 0;
+    uint32_t nextConnectionEventMs = 0;
+};
+
+} // namespace Nuki
@@ -0,0 +1,188 @@
+/**
+ * @file NukiLoadGenerator.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiLoadGenerator.h"
+
+namespace NukiLock {
+
+bool LoadGenerator::addDevice(NukiLock* device) {
+  if (nrOfDevices >= NUKI_LOAD_MAX_DEVICES) {
+    return false;
+  }
+  devices[nrOfDevices++] = device;
+  return true;
+}
+
+LoadReport LoadGenerator::run(const LoadOptions& runOptions) {
+  LoadReport report = {};
+  if (nrOfDevices == 0 || runOptions.tasks == 0) {
+    log_w("Load generator needs at least one device and one task");
+    return report;
+  }
+
+  options = runOptions;
+  if (options.tasks > NUKI_LOAD_MAX_TASKS) {
+    options.tasks = NUKI_LOAD_MAX_TASKS;
+  }
+  for (uint8_t i = 0; i < LOAD_OPERATION_COUNT; i++) {
+    histograms[i].reset();
+    succeeded[i] = 0;
+    failed[i] = 0;
+  }
+
+  uint32_t timeoutsBefore;
+  uint32_t acquisitionsBefore;
+  uint64_t waitUsBefore;
+  sumSemaphoreMetrics(timeoutsBefore, acquisitionsBefore, waitUsBefore);
+
+  runnerTaskHandle = xTaskGetCurrentTaskHandle();
+  int64_t startUs = esp_timer_get_time();
+  endUs = startUs + (int64_t)options.durationMs * 1000;
+  uint8_t started = 0;
+  for (uint8_t i = 0; i < options.tasks; i++) {
+    callers[i].generator = this;
+    callers[i].device = devices[i % nrOfDevices];
+    callers[i].randomState = options.seed * 31 + i + 1;
+    if (xTaskCreatePinnedToCore(&LoadGenerator::callerTask, "nukiLoad", NUKI_LOAD_TASK_STACK_SIZE, &callers[i],
+                                NUKI_LOAD_TASK_PRIORITY, nullptr, tskNO_AFFINITY) == pdPASS) {
+      started++;
+    } else {
+      log_w("Unable to start load task %d", i);
+    }
+  }
+
+  //every caller notifies once when done
+  for (uint8_t i = 0; i < started; i++) {
+    ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+  }
+  report.durationMs = (esp_timer_get_time() - startUs) / 1000;
+
+  uint32_t completed = 0;
+  for (uint8_t i = 0; i < LOAD_OPERATION_COUNT; i++) {
+    report.operations[i].succeeded = succeeded[i];
+    report.operations[i].failed = failed[i];
+    report.operations[i].latency = histograms[i].getPercentiles();
+    completed += succeeded[i] + failed[i];
+  }
+  report.throughput = report.durationMs > 0 ? completed * 1000.0 / report.durationMs : 0;
+
+  sumSemaphoreMetrics(report.semaphoreTimeouts, report.semaphoreAcquisitions, report.semaphoreWaitUs);
+  report.semaphoreTimeouts -= timeoutsBefore;
+  report.semaphoreAcquisitions -= acquisitionsBefore;
+  report.semaphoreWaitUs -= waitUsBefore;
+  return report;
+}
+
+void LoadGenerator::callerTask(void* pvParameters) {
+  Caller* caller = (Caller*)pvParameters;
+  caller->generator->runCaller(*caller);
+  xTaskNotifyGive(caller->generator->runnerTaskHandle);
+  vTaskDelete(NULL);
+}
+
+void LoadGenerator::runCaller(Caller& caller) {
+  while (esp_timer_get_time() < endUs) {
+    LoadOperation operation = pickOperation(caller.randomState);
+    int64_t startUs = esp_timer_get_time();
+    Nuki::CmdResult result = execute(caller.device, operation);
+    uint32_t latencyMs = (esp_timer_get_time() - startUs) / 1000;
+
+    uint8_t index = (uint8_t)operation;
+    portENTER_CRITICAL(&mux);
+    histograms[index].record(latencyMs);
+    if (result == Nuki::CmdResult::Success) {
+      succeeded[index]++;
+    } else {
+      failed[index]++;
+    }
+    portEXIT_CRITICAL(&mux);
+
+    if (options.thinkTimeMs > 0) {
+      vTaskDelay(options.thinkTimeMs / portTICK_PERIOD_MS);
+    } else {
+      taskYIELD();
+    }
+  }
+}
+
+LoadOperation LoadGenerator::pickOperation(uint32_t& randomState) const {
+  uint32_t totalWeight = 0;
+  for (uint8_t i = 0; i < LOAD_OPERATION_COUNT; i++) {
+    totalWeight += options.weights[i];
+  }
+  if (totalWeight == 0) {
+    return LoadOperation::RequestKeyTurnerState;
+  }
+
+  //xorshift32
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  uint32_t pick = randomState % totalWeight;
+  for (uint8_t i = 0; i < LOAD_OPERATION_COUNT; i++) {
+    if (pick < options.weights[i]) {
+      return (LoadOperation)i;
+    }
+    pick -= options.weights[i];
+  }
+  return LoadOperation::RequestKeyTurnerState;
+}
+
+Nuki::CmdResult LoadGenerator::execute(NukiLock* device, const LoadOperation operation) {
+  switch (operation) {
+    case LoadOperation::LockAction:
+      return device->lockAction(options.lockAction);
+    case LoadOperation::RequestKeyTurnerState: {
+      KeyTurnerState state;
+      return device->requestKeyTurnerState(&state);
+    }
+    case LoadOperation::RequestConfig: {
+      Config config;
+      return device->requestConfig(&config);
+    }
+    case LoadOperation::RetrieveLogEntries:
+      return device->retrieveLogEntries(0, options.logEntryCount, 0, false);
+    default:
+      return Nuki::CmdResult::Error;
+  }
+}
+
+void LoadGenerator::sumSemaphoreMetrics(uint32_t& timeouts, uint32_t& acquisitions, uint64_t& waitUs) const {
+  timeouts = 0;
+  acquisitions = 0;
+  waitUs = 0;
+  Nuki::NukiMetrics metrics;
+  for (uint8_t i = 0; i < nrOfDevices; i++) {
+    devices[i]->getMetrics(&metrics);
+    timeouts += metrics.semaphoreTimeouts;
+    acquisitions += metrics.semaphoreAcquisitions;
+    waitUs += metrics.semaphoreWaitUs;
+  }
+}
+
+void printLoadReport(const LoadReport& report, Print& out) {
+  const char* names[LOAD_OPERATION_COUNT] = {"lockAction", "requestKeyTurnerState", "requestConfig", "retrieveLogEntries"};
+  out.printf("duration %u ms, throughput %.2f ops/s\n", report.durationMs, report.throughput);
+  out.printf("%-22s %8s %8s %8s %8s %8s %8s\n", "operation", "ok", "failed", "p50 ms", "p95 ms", "p99 ms", "max ms");
+  for (uint8_t i = 0; i < LOAD_OPERATION_COUNT; i++) {
+    const OperationReport& operation = report.operations[i];
+    out.printf("%-22s %8u %8u %8u %8u %8u %8u\n", names[i], operation.succeeded, operation.failed,
+               operation.latency.p50Ms, operation.latency.p95Ms, operation.latency.p99Ms, operation.latency.maxMs);
+  }
+  uint32_t attempts = report.semaphoreAcquisitions + report.semaphoreTimeouts;
+  out.printf("semaphore: %u acquisitions, %u timeouts (%.2f%%), %.1f ms waiting (avg %.2f ms)\n",
+             report.semaphoreAcquisitions, report.semaphoreTimeouts,
+             attempts > 0 ? report.semaphoreTimeouts * 100.0 / attempts : 0.0,
+             report.semaphoreWaitUs / 1000.0, attempts > 0 ? report.semaphoreWaitUs / 1000.0 / attempts : 0.0);
+}
+
+} // namespace NukiLock
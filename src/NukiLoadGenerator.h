@@ -0,0 +1,119 @@
+#pragma once
+/**
+ * @file NukiLoadGenerator.h
+ * Concurrent multi-caller load against one or more NukiLock devices
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiLock.h"
+#include "NukiCommandLatency.h"
+
+#ifndef NUKI_LOAD_MAX_DEVICES
+#define NUKI_LOAD_MAX_DEVICES 4
+#endif
+#ifndef NUKI_LOAD_MAX_TASKS
+#define NUKI_LOAD_MAX_TASKS 16
+#endif
+#ifndef NUKI_LOAD_TASK_STACK_SIZE
+#define NUKI_LOAD_TASK_STACK_SIZE 8192
+#endif
+#ifndef NUKI_LOAD_TASK_PRIORITY
+#define NUKI_LOAD_TASK_PRIORITY 1
+#endif
+
+namespace NukiLock {
+
+enum class LoadOperation : uint8_t {
+  LockAction,
+  RequestKeyTurnerState,
+  RequestConfig,
+  RetrieveLogEntries
+};
+
+const uint8_t LOAD_OPERATION_COUNT = 4;
+
+struct LoadOptions {
+  uint8_t tasks = 4;                //concurrent callers, spread round robin over the devices
+  uint32_t durationMs = 10000;      //wall clock time after which no new operations are started
+  uint32_t thinkTimeMs = 0;         //pause of a caller between two operations
+  uint8_t weights[LOAD_OPERATION_COUNT] = {1, 4, 2, 1}; //relative frequency per LoadOperation
+  LockAction lockAction = LockAction::Lock;
+  uint16_t logEntryCount = 5;
+  uint32_t seed = 1;
+};
+
+struct OperationReport {
+  uint32_t succeeded;
+  uint32_t failed;
+  Nuki::LatencyPercentiles latency; //wall clock latency of the library call
+};
+
+struct LoadReport {
+  OperationReport operations[LOAD_OPERATION_COUNT];
+  uint32_t durationMs;
+  float throughput;                 //completed operations per second
+  uint32_t semaphoreTimeouts;       //summed over all devices, during the run
+  uint32_t semaphoreAcquisitions;
+  uint64_t semaphoreWaitUs;         //time callers spent waiting in takeNukiBleSemaphore
+};
+
+/**
+ * @brief Runs a configurable mix of lockAction, requestKeyTurnerState, requestConfig and retrieveLogEntries from
+ * multiple FreeRTOS tasks against one or more devices and reports throughput, per operation latency percentiles,
+ * failures and the contention on the BLE semaphore.
+ *
+ * Meant for paired devices driven by a LinkSimulator or for a lock on the bench. Latencies are measured with
+ * esp_timer, with a VirtualClock shared by several callers virtual time runs faster than wall clock time.
+ */
+class LoadGenerator {
+  public:
+    /**
+     * @return false if NUKI_LOAD_MAX_DEVICES devices were already added
+     */
+    bool addDevice(NukiLock* device);
+
+    /**
+     * @brief Starts options.tasks callers and blocks until all of them finished
+     */
+    LoadReport run(const LoadOptions& options = LoadOptions());
+
+  private:
+    struct Caller {
+      LoadGenerator* generator;
+      NukiLock* device;
+      uint32_t randomState;
+    };
+
+    static void callerTask(void* pvParameters);
+    void runCaller(Caller& caller);
+    LoadOperation pickOperation(uint32_t& randomState) const;
+    Nuki::CmdResult execute(NukiLock* device, const LoadOperation operation);
+    void sumSemaphoreMetrics(uint32_t& timeouts, uint32_t& acquisitions, uint64_t& waitUs) const;
+
+    NukiLock* devices[NUKI_LOAD_MAX_DEVICES];
+    uint8_t nrOfDevices = 0;
+
+    //valid during run()
+    LoadOptions options;
+    Caller callers[NUKI_LOAD_MAX_TASKS];
+    TaskHandle_t runnerTaskHandle = nullptr;
+    int64_t endUs = 0;
+    Nuki::LatencyHistogram histograms[LOAD_OPERATION_COUNT];
+    uint32_t succeeded[LOAD_OPERATION_COUNT];
+    uint32_t failed[LOAD_OPERATION_COUNT];
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+/**
+ * @brief Prints report as a table, one line per operation
+ */
+void printLoadReport(const LoadReport& report, Print& out);
+
+} // namespace NukiLock
@@ -12,6 +12,10 @@ NukiLock::NukiLock(const std::string& deviceName, const uint32_t deviceId)
             keyturnerUserDataUUID,
             deviceName) {}
 
+NukiLock::~NukiLock() {
+  stopTasks();
+}
+
 Nuki::CmdResult NukiLock::lockAction(const LockAction lockAction, const uint32_t nukiAppId, const uint8_t flags, const char* nameSuffix, const uint8_t nameSuffixLen) {
   Action action;
   unsigned char payload[5 + nameSuffixLen] = {0};
@@ -47,13 +51,31 @@ Nuki::CmdResult NukiLock::requestKeyTurnerState(KeyTurnerState* retrievedKeyTurn
   Nuki::CmdResult result = executeAction(action);
   if (result == Nuki::CmdResult::Success) {
     // printBuffer((byte*)&retrievedKeyTurnerState, sizeof(retrievedKeyTurnerState), false, "retreived Keyturner state");
-    memcpy(retrievedKeyTurnerState, &keyTurnerState, sizeof(KeyTurnerState));
+    *retrievedKeyTurnerState = keyTurnerStateSnapshot.read();
   }
   return result;
 }
 
+Nuki::CmdResult NukiLock::requestKeyTurnerState(KeyTurnerState* retrievedKeyTurnerState, const uint32_t maxAgeMs, const bool allowStale) {
+  if (isStateFresh(maxAgeMs)) {
+    *retrievedKeyTurnerState = keyTurnerStateSnapshot.read();
+    return Nuki::CmdResult::Success;
+  }
+  if (allowStale && hasStateReceived()) {
+    refreshStateInBackground();
+    *retrievedKeyTurnerState = keyTurnerStateSnapshot.read();
+    return Nuki::CmdResult::Success;
+  }
+  return requestKeyTurnerState(retrievedKeyTurnerState);
+}
+
+Nuki::CmdResult NukiLock::refreshState() {
+  KeyTurnerState state;
+  return requestKeyTurnerState(&state);
+}
+
 void NukiLock::retrieveKeyTunerState(KeyTurnerState* retrievedKeyTurnerState) {
-  memcpy(retrievedKeyTurnerState, &keyTurnerState, sizeof(KeyTurnerState));
+  *retrievedKeyTurnerState = keyTurnerStateSnapshot.read();
 }
 
 
@@ -75,6 +97,12 @@ Nuki::CmdResult NukiLock::requestBatteryReport(BatteryReport* retrievedBatteryRe
 
 
 Nuki::CmdResult NukiLock::requestConfig(Config* retrievedConfig) {
+  uint32_t cacheGeneration = getConfigCacheGeneration();
+  if (configCachedAt == cacheGeneration) {
+    *retrievedConfig = configCache.read();
+    return Nuki::CmdResult::Success;
+  }
+
   Action action;
 
   action.cmdType = Nuki::CommandType::CommandWithChallenge;
@@ -83,11 +111,19 @@ Nuki::CmdResult NukiLock::requestConfig(Config* retrievedConfig) {
   Nuki::CmdResult result = executeAction(action);
   if (result == Nuki::CmdResult::Success) {
     memcpy(retrievedConfig, &config, sizeof(Config));
+    configCache.write(*retrievedConfig);
+    configCachedAt = cacheGeneration;
   }
   return result;
 }
 
 Nuki::CmdResult NukiLock::requestAdvancedConfig(AdvancedConfig* retrievedAdvancedConfig) {
+  uint32_t cacheGeneration = getConfigCacheGeneration();
+  if (advancedConfigCachedAt == cacheGeneration) {
+    *retrievedAdvancedConfig = advancedConfigCache.read();
+    return Nuki::CmdResult::Success;
+  }
+
   Action action;
 
   action.cmdType = Nuki::CommandType::CommandWithChallenge;
@@ -96,22 +132,24 @@ Nuki::CmdResult NukiLock::requestAdvancedConfig(AdvancedConfig* retrievedAdvance
   Nuki::CmdResult result = executeAction(action);
   if (result == Nuki::CmdResult::Success) {
     memcpy(retrievedAdvancedConfig, &advancedConfig, sizeof(AdvancedConfig));
+    advancedConfigCache.write(*retrievedAdvancedConfig);
+    advancedConfigCachedAt = cacheGeneration;
   }
   return result;
 }
 
+NukiLock::ConfigTransaction NukiLock::beginConfigTransaction() {
+  return ConfigTransaction(*this);
+}
+
 
 //basic config change methods
 Nuki::CmdResult NukiLock::setName(const std::string& name) {
 
   if (name.length() <= 32) {
-    Config oldConfig;
-    Nuki::CmdResult result = requestConfig(&oldConfig);
-    if (result == Nuki::CmdResult::Success) {
-      memcpy(oldConfig.name, name.c_str(), name.length());
-      result = setFromConfig(oldConfig);
-    }
-    return result;
+    ConfigTransaction transaction = beginConfigTransaction();
+    memcpy(transaction.config().name, name.c_str(), name.length());
+    return transaction.commit();
   } else {
     log_w("setName, too long (max32)");
     return Nuki::CmdResult::Failed;
@@ -120,135 +158,83 @@ Nuki::CmdResult NukiLock::setName(const std::string& name) {
 
 
 Nuki::CmdResult NukiLock::enableDst(const bool enable) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.dstMode = enable;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().dstMode = enable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::setTimeZoneOffset(const int16_t minutes) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.timeZoneOffset = minutes;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().timeZoneOffset = minutes;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::setTimeZoneId(const TimeZoneId timeZoneId) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.timeZoneId = timeZoneId;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().timeZoneId = timeZoneId;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::enableButton(const bool enable) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.buttonEnabled = enable;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().buttonEnabled = enable;
+  return transaction.commit();
 }
 
 
 //advanced config change methods
 Nuki::CmdResult NukiLock::setSingleButtonPressAction(const ButtonPressAction action) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.singleButtonPressAction = action;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().singleButtonPressAction = action;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::setDoubleButtonPressAction(const ButtonPressAction action) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.doubleButtonPressAction = action;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().doubleButtonPressAction = action;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::setBatteryType(const BatteryType type) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.batteryType = type;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().batteryType = type;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::enableAutoBatteryTypeDetection(const bool enable) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.automaticBatteryTypeDetection = enable;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().automaticBatteryTypeDetection = enable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::disableAutoUnlock(const bool disable) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.autoUnLockDisabled = disable;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().autoUnLockDisabled = disable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::enableAutoLock(const bool enable) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.autoLockEnabled = enable;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().autoLockEnabled = enable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::enableImmediateAutoLock(const bool enable) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.immediateAutoLockEnabled = enable;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().immediateAutoLockEnabled = enable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::enableAutoUpdate(const bool enable) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.autoUpdateEnabled = enable;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().autoUpdateEnabled = enable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::enablePairing(const bool enable) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.pairingEnabled = enable;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().pairingEnabled = enable;
+  return transaction.commit();
 }
 
 bool NukiLock::pairingEnabled() {
@@ -261,44 +247,28 @@ bool NukiLock::pairingEnabled() {
 }
 
 Nuki::CmdResult NukiLock::enableLedFlash(const bool enable) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.ledEnabled = enable;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().ledEnabled = enable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::setLedBrightness(const uint8_t level) {
   //level is from 0 (off) to 5(max)
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.ledBrightness = level > 5 ? 5 : level;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().ledBrightness = level > 5 ? 5 : level;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::enableSingleLock(const bool enable) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.singleLock = enable;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().singleLock = enable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiLock::setAdvertisingMode(const AdvertisingMode mode) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.advertisingMode = mode;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().advertisingMode = mode;
+  return transaction.commit();
 }
 
 
@@ -384,12 +354,27 @@ void NukiLock::getTimeControlEntries(std::list<TimeControlEntry>* requestedTimeC
 void NukiLock::getLogEntries(std::list<LogEntry>* requestedLogEntries) {
   requestedLogEntries->clear();
 
+  xSemaphoreTake(logEntriesSemaphore, portMAX_DELAY);
   for (const auto& it : listOfLogEntries) {
     requestedLogEntries->push_back(it);
   }
+  xSemaphoreGive(logEntriesSemaphore);
+}
+
+uint32_t NukiLock::getLogEntriesReceived() const {
+  return logEntriesReceived;
+}
+
+bool NukiLock::getLogEntryCountSnapshot(LogEntryCount* count) const {
+  if (!logEntryCountReceived) {
+    return false;
+  }
+  *count = logEntryCountSnapshot.read();
+  return true;
 }
 
 Nuki::CmdResult NukiLock::retrieveLogEntries(const uint32_t startIndex, const uint16_t count, const uint8_t sortOrder, bool const totalCount) {
+  Nuki::ConnectionProfileScope bulkTransfer(Nuki::ConnectionProfile::Bulk);
   Action action;
   unsigned char payload[8] = {0};
   memcpy(payload, &startIndex, 4);
@@ -402,12 +387,18 @@ Nuki::CmdResult NukiLock::retrieveLogEntries(const uint32_t startIndex, const ui
   memcpy(action.payload, &payload, sizeof(payload));
   action.payloadLen = sizeof(payload);
 
+  xSemaphoreTake(logEntriesSemaphore, portMAX_DELAY);
   listOfLogEntries.clear();
+  xSemaphoreGive(logEntriesSemaphore);
+  if (totalCount) {
+    logEntryCountReceived = false;
+  }
 
   return executeAction(action);
 }
 
 Nuki::CmdResult NukiLock::retrieveAuthorizationEntries(const uint16_t offset, const uint16_t count) {
+  Nuki::ConnectionProfileScope bulkTransfer(Nuki::ConnectionProfile::Bulk);
   Action action;
   unsigned char payload[4] = {0};
   memcpy(payload, &offset, 2);
@@ -437,22 +428,23 @@ Nuki::CmdResult NukiLock::deleteAuthorizationEntry(uint32_t id) {
 }
 
 bool NukiLock::isBatteryCritical() {
-  return ((keyTurnerState.criticalBatteryState & (1 << 0)) != 0);
+  return ((keyTurnerStateSnapshot.read().criticalBatteryState & (1 << 0)) != 0);
 }
 
 bool NukiLock::isKeypadBatteryCritical() {
-  if ((keyTurnerState.accessoryBatteryState & (1 << 7)) != 0) {
-    return ((keyTurnerState.accessoryBatteryState & (1 << 6)) != 0);
+  uint8_t accessoryBatteryState = keyTurnerStateSnapshot.read().accessoryBatteryState;
+  if ((accessoryBatteryState & (1 << 7)) != 0) {
+    return ((accessoryBatteryState & (1 << 6)) != 0);
   }
   return false;
 }
 
 bool NukiLock::isBatteryCharging() {
-  return ((keyTurnerState.criticalBatteryState & (1 << 1)) != 0);
+  return ((keyTurnerStateSnapshot.read().criticalBatteryState & (1 << 1)) != 0);
 }
 
 uint8_t NukiLock::getBatteryPerc() {
-  return (keyTurnerState.criticalBatteryState & 0b11111100) >> 1;
+  return (keyTurnerStateSnapshot.read().criticalBatteryState & 0b11111100) >> 1;
 }
 
 const ErrorCode NukiLock::getLastError() const {
@@ -469,7 +461,9 @@ Nuki::CmdResult NukiLock::setConfig(NewConfig newConfig) {
   memcpy(action.payload, &payload, sizeof(payload));
   action.payloadLen = sizeof(payload);
 
-  return executeAction(action);
+  Nuki::CmdResult result = executeAction(action);
+  invalidateConfigCache();
+  return result;
 }
 
 Nuki::CmdResult NukiLock::setFromConfig(const Config config) {
@@ -494,7 +488,9 @@ Nuki::CmdResult NukiLock::setAdvancedConfig(NewAdvancedConfig newAdvancedConfig)
   memcpy(action.payload, &payload, sizeof(payload));
   action.payloadLen = sizeof(payload);
 
-  return executeAction(action);
+  Nuki::CmdResult result = executeAction(action);
+  invalidateConfigCache();
+  return result;
 }
 
 
@@ -548,10 +544,15 @@ void NukiLock::handleReturnMessage(Command returnCode, unsigned char* data, uint
   switch (returnCode) {
     case Command::KeyturnerStates : {
       printBuffer((byte*)data, dataLen, false, "keyturnerStates");
+      KeyTurnerState previousState = keyTurnerState;
       memcpy(&keyTurnerState, data, sizeof(keyTurnerState));
+      keyTurnerStateSnapshot.write(keyTurnerState);
+      markStateReceived();
+      updateConfigUpdateCount(keyTurnerState.configUpdateCount);
       #ifdef DEBUG_NUKI_READABLE_DATA
       logKeyturnerState(keyTurnerState);
       #endif
+      publishStateEvents(previousState, keyTurnerState);
       break;
     }
     case Command::BatteryReport : {
@@ -589,10 +590,27 @@ void NukiLock::handleReturnMessage(Command returnCode, unsigned char* data, uint
       printBuffer((byte*)data, dataLen, false, "logEntry");
       LogEntry logEntry;
       memcpy(&logEntry, data, sizeof(logEntry));
+      xSemaphoreTake(logEntriesSemaphore, portMAX_DELAY);
       listOfLogEntries.push_back(logEntry);
+      xSemaphoreGive(logEntriesSemaphore);
+      logEntriesReceived++;
       #ifdef DEBUG_NUKI_READABLE_DATA
       logLogEntry(logEntry);
       #endif
+      Event event;
+      event.type = EventType::NewLogEntry;
+      event.logEntry.index = logEntry.index;
+      event.logEntry.loggingType = (uint8_t)logEntry.loggingType;
+      publishEvent(event);
+      break;
+    }
+    case Command::LogEntryCount : {
+      LogEntryCount count;
+      memcpy(&count, data, sizeof(count));
+      logEntryCountSnapshot.write(count);
+      logEntryCountReceived = true;
+      //getLogEntryCount() of the base class
+      NukiBle::handleReturnMessage(returnCode, data, dataLen);
       break;
     }
     case Command::AuthorizationEntry : {
@@ -609,6 +627,52 @@ void NukiLock::handleReturnMessage(Command returnCode, unsigned char* data, uint
   lastMsgCodeReceived = returnCode;
 }
 
+void NukiLock::publishStateEvents(const KeyTurnerState& previous, const KeyTurnerState& current) {
+  if (!keyTurnerStateReceived) {
+    //first state received is the baseline for transitions and the field diff
+    keyTurnerStateReceived = true;
+    return;
+  }
+  Event event;
+  if (previous.lockState != current.lockState) {
+    event.type = EventType::LockStateChanged;
+    event.stateChange.previous = (uint8_t)previous.lockState;
+    event.stateChange.current = (uint8_t)current.lockState;
+    publishEvent(event);
+  }
+  if (previous.doorSensorState != current.doorSensorState) {
+    event.type = EventType::DoorSensorStateChanged;
+    event.stateChange.previous = (uint8_t)previous.doorSensorState;
+    event.stateChange.current = (uint8_t)current.doorSensorState;
+    publishEvent(event);
+  }
+  if ((current.criticalBatteryState & 0x01) && !(previous.criticalBatteryState & 0x01)) {
+    event.type = EventType::BatteryCritical;
+    event.battery.criticalBatteryState = current.criticalBatteryState;
+    event.battery.percentage = (current.criticalBatteryState & 0b11111100) >> 1;
+    publishEvent(event);
+  }
+
+  publishFieldChange(StateField::NukiState, (int32_t)previous.nukiState, (int32_t)current.nukiState);
+  publishFieldChange(StateField::LockState, (int32_t)previous.lockState, (int32_t)current.lockState);
+  publishFieldChange(StateField::Trigger, (int32_t)previous.trigger, (int32_t)current.trigger);
+  publishFieldChange(StateField::TimeZoneOffset, previous.timeZoneOffset, current.timeZoneOffset);
+  publishFieldChange(StateField::CriticalBatteryState, previous.criticalBatteryState, current.criticalBatteryState);
+  publishFieldChange(StateField::BatteryCritical, previous.criticalBatteryState & 0x01, current.criticalBatteryState & 0x01);
+  publishFieldChange(StateField::BatteryCharging, (previous.criticalBatteryState & 0x02) >> 1, (current.criticalBatteryState & 0x02) >> 1);
+  publishFieldChange(StateField::BatteryPercentage, (previous.criticalBatteryState & 0b11111100) >> 1,
+                     (current.criticalBatteryState & 0b11111100) >> 1);
+  publishFieldChange(StateField::ConfigUpdateCount, previous.configUpdateCount, current.configUpdateCount);
+  publishFieldChange(StateField::LockNgoTimer, previous.lockNgoTimer, current.lockNgoTimer);
+  publishFieldChange(StateField::LastLockAction, (int32_t)previous.lastLockAction, (int32_t)current.lastLockAction);
+  publishFieldChange(StateField::LastLockActionTrigger, (int32_t)previous.lastLockActionTrigger, (int32_t)current.lastLockActionTrigger);
+  publishFieldChange(StateField::LastLockActionCompletionStatus, (int32_t)previous.lastLockActionCompletionStatus,
+                     (int32_t)current.lastLockActionCompletionStatus);
+  publishFieldChange(StateField::DoorSensorState, (int32_t)previous.doorSensorState, (int32_t)current.doorSensorState);
+  publishFieldChange(StateField::NightModeActive, previous.nightModeActive, current.nightModeActive);
+  publishFieldChange(StateField::AccessoryBatteryState, previous.accessoryBatteryState, current.accessoryBatteryState);
+}
+
 void NukiLock::logErrorCode(uint8_t errorCode) {
   logLockErrorCode(errorCode);
 }
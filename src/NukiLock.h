@@ -1,14 +1,20 @@
 #pragma once
 
 #include "NukiBle.h"
+#include "NukiConfigTransaction.h"
 #include "NukiLockConstants.h"
 #include "NukiLockUtils.h"
 
 namespace NukiLock {
 
 class NukiLock : public Nuki::NukiBle {
+    friend class Nuki::ConfigTransaction<NukiLock, Config, AdvancedConfig>;
+
   public:
+    typedef Nuki::ConfigTransaction<NukiLock, Config, AdvancedConfig> ConfigTransaction;
+
     NukiLock(const std::string& deviceName, const uint32_t deviceId);
+    virtual ~NukiLock();
 
 
     /**
@@ -33,7 +39,18 @@ class NukiLock : public Nuki::NukiBle {
     Nuki::CmdResult requestKeyTurnerState(KeyTurnerState* retrievedKeyTurnerState);
 
     /**
-     * @brief Gets the last keyturner state stored on the esp
+     * @brief Returns the stored state if it is not older than maxAgeMs, otherwise requests it via BLE.
+     * Callers polling the same device share one BLE exchange within the freshness bound
+     *
+     * @param retrievedKeyTurnerState Nuki api based datatype to store the retrieved state
+     * @param maxAgeMs maximum age in milliseconds of the stored state to be returned without BLE request
+     * @param allowStale if true an outdated state is returned immediately and refreshed in a background task,
+     * only if no state has been received at all the request is done synchronously
+     */
+    Nuki::CmdResult requestKeyTurnerState(KeyTurnerState* retrievedKeyTurnerState, const uint32_t maxAgeMs, const bool allowStale = false);
+
+    /**
+     * @brief Gets the last keyturner state stored on the esp, lock-free and safe to call from any task
      *
      * @param retrievedKeyTurnerState Nuki api based datatype to store the retrieved keyturnerstate
      */
@@ -49,19 +66,31 @@ class NukiLock : public Nuki::NukiBle {
 
 
     /**
-     * @brief Requests config from Lock via BLE
+     * @brief Requests config from Lock via BLE, a cached copy is returned without BLE request as long as
+     * the configUpdateCount in the received keyturner state has not changed and no config has been written.
+     * The currentTime fields of a cached config hold the device time when the config was read, the current
+     * device time is part of the keyturner state
      *
      * @param retrievedConfig Nuki api based datatype to store the retrieved config
      */
     Nuki::CmdResult requestConfig(Config* retrievedConfig);
 
     /**
-     * @brief Requests advanced config from Lock via BLE
+     * @brief Requests advanced config from Lock via BLE, a cached copy is returned without BLE request as long as
+     * the configUpdateCount in the received keyturner state has not changed and no config has been written
      *
      * @param retrievedAdvancedConfig Nuki api based datatype to store the retrieved advanced config
      */
     Nuki::CmdResult requestAdvancedConfig(AdvancedConfig* retrievedAdvancedConfig);
 
+    /**
+     * @brief Starts a config transaction, edits of config and advanced config are collected and
+     * written with one command per config on commit(), unchanged configs are not written
+     *
+     * @return transaction bound to this device
+     */
+    ConfigTransaction beginConfigTransaction();
+
 
     /**
      * @brief Gets the current config from the lock, updates the name parameter and sends the
@@ -263,6 +292,21 @@ class NukiLock : public Nuki::NukiBle {
      */
     void getLogEntries(std::list<LogEntry>* requestedLogEntries);
 
+    /**
+     * @brief Returns the number of log entries received since start. The entries requested by retrieveLogEntries()
+     * keep arriving after the call returned, the counter shows the progress of the transfer.
+     */
+    uint32_t getLogEntriesReceived() const;
+
+    /**
+     * @brief Get the complete log entry count message (logging and door sensor flags included) sent by the lock
+     * when retrieveLogEntries() was called with totalCount, getLogEntryCount() returns the count only
+     *
+     * @param count is filled with the received count
+     * @return false if no count was received since the last retrieveLogEntries() with totalCount
+     */
+    bool getLogEntryCountSnapshot(LogEntryCount* count) const;
+
     /**
      * @brief Request the lock via BLE to send the log entries
      *
@@ -333,6 +377,7 @@ class NukiLock : public Nuki::NukiBle {
     virtual void logErrorCode(uint8_t errorCode) override;
 
   protected:
+    Nuki::CmdResult refreshState() override;
     void handleReturnMessage(Command returnCode, unsigned char* data, uint16_t dataLen) override;
 
 
@@ -343,15 +388,27 @@ class NukiLock : public Nuki::NukiBle {
     void createNewConfig(const Config* oldConfig, NewConfig* newConfig);
     void createNewAdvancedConfig(const AdvancedConfig* oldConfig, NewAdvancedConfig* newConfig);
     Nuki::CmdResult setFromAdvancedConfig(const AdvancedConfig config);
+    void publishStateEvents(const KeyTurnerState& previous, const KeyTurnerState& current);
 
-    KeyTurnerState keyTurnerState;
+    KeyTurnerState keyTurnerState;  //only accessed from the notification task, other tasks read keyTurnerStateSnapshot
+    Nuki::SeqLock<KeyTurnerState> keyTurnerStateSnapshot;
+    bool keyTurnerStateReceived = false;
     BatteryReport batteryReport;
     std::list<TimeControlEntry> listOfTimeControlEntries;
+    //filled by the notification task while the caller reads, guarded by logEntriesSemaphore
     std::list<LogEntry> listOfLogEntries;
+    SemaphoreHandle_t logEntriesSemaphore = xSemaphoreCreateMutex();
+    std::atomic<uint32_t> logEntriesReceived{0};
+    Nuki::SeqLock<LogEntryCount> logEntryCountSnapshot;
+    std::atomic<bool> logEntryCountReceived{false};
     std::list<AuthorizationEntry> listOfAuthorizationEntries;
 
     Config config;
     AdvancedConfig advancedConfig;
+    Nuki::SeqLock<Config> configCache;
+    Nuki::SeqLock<AdvancedConfig> advancedConfigCache;
+    std::atomic<uint32_t> configCachedAt{0};
+    std::atomic<uint32_t> advancedConfigCachedAt{0};
 };
 
 }
\ No newline at end of file
@@ -319,6 +319,13 @@ struct __attribute__((packed)) LogEntry {
   uint8_t data[5];
 };
 
+struct __attribute__((packed)) LogEntryCount {
+  uint8_t loggingEnabled;
+  uint16_t count;
+  uint8_t doorSensorEnabled;
+  uint8_t doorSensorLoggingEnabled;
+};
+
 inline void lockactionToString(const LockAction action, char* str) {
   switch (action) {
     case LockAction::Unlock:
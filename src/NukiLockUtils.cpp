@@ -33,6 +33,9 @@ void cmdResultToString(const CmdResult state, char* str) {
     case CmdResult::NotPaired:
       strcpy(str, "notPaired");
       break;
+    case CmdResult::DeadlineExceeded:
+      strcpy(str, "deadlineExceeded");
+      break;
     case CmdResult::Error:
       strcpy(str, "error");
       break;
@@ -0,0 +1,217 @@
+/**
+ * @file NukiLogDownloader.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiLogDownloader.h"
+
+namespace NukiLock {
+
+LogDownloader::LogDownloader(NukiLock* lock)
+  : lock(lock) {
+}
+
+void LogDownloader::begin(const LogDownloadOptions& downloadOptions) {
+  options = downloadOptions;
+  if (options.chunkSize == 0) {
+    options.chunkSize = 1;
+  }
+  checkpoint = {false, 0, 0, -1};
+  pauseRequested = false;
+  state = LogDownloadState::Paused;
+}
+
+LogDownloadReport LogDownloader::run(EntryCallback callback) {
+  LogDownloadReport report = {};
+  report.lastResult = Nuki::CmdResult::Success;
+  if (state == LogDownloadState::Idle) {
+    log_w("Log download not started, call begin() first");
+    report.state = LogDownloadState::Idle;
+    return report;
+  }
+
+  Nuki::Clock* clock = lock->getClock();
+  const Nuki::RetryPolicy retryPolicy = lock->getRetryPolicy();
+  const uint32_t startMs = clock->nowMs();
+  pauseRequested = false;
+  state = LogDownloadState::Running;
+
+  uint8_t retry = 0;
+  uint32_t startIndex;
+  uint16_t count;
+  while (nextChunk(&startIndex, &count)) {
+    if (pauseRequested) {
+      state = LogDownloadState::Paused;
+      break;
+    }
+
+    const bool requestTotal = checkpoint.total < 0 && options.startIndex == 0;
+    const uint32_t receivedBefore = lock->getLogEntriesReceived();
+    report.lastResult = lock->retrieveLogEntries(startIndex, count, options.sortOrder, requestTotal);
+
+    bool complete = false;
+    if (report.lastResult == Nuki::CmdResult::Success) {
+      report.chunks++;
+      complete = awaitChunk(receivedBefore, count);
+
+      LogEntryCount total;
+      if (requestTotal && lock->getLogEntryCountSnapshot(&total)) {
+        checkpoint.total = total.count;
+      }
+      bool gap;
+      uint16_t delivered = deliver(callback, report, &gap);
+      report.entries += delivered;
+
+      if (gap) {
+        report.gaps++;
+        complete = false;
+        log_w("Log entry %d missing, requesting again", nextIndex());
+      } else if (!complete) {
+        //the lock ends the stream early at the end of the log, without a known total a short chunk is the end
+        if (checkpoint.total < 0 || options.startIndex != 0 || checkpoint.delivered >= (uint32_t)checkpoint.total) {
+          state = LogDownloadState::Complete;
+          break;
+        }
+        log_w("Log download interrupted after %d of %d entries, resuming at %d", delivered, count,
+              checkpoint.lastIndex);
+      }
+      if (delivered > 0) {
+        retry = 0;
+      }
+    }
+
+    if (!complete) {
+      if (retry >= options.maxRetries) {
+        log_w("Log download failed at index %d, result: %d", checkpoint.lastIndex, (int)report.lastResult);
+        state = LogDownloadState::Failed;
+        break;
+      }
+      clock->sleepMs(retryPolicy.backoffMs(retry, NUKI_LOG_DOWNLOAD_POLL * 10));
+      retry++;
+      report.retries++;
+    }
+  }
+
+  if (state == LogDownloadState::Running) {
+    state = LogDownloadState::Complete;
+  }
+  report.state = state;
+  report.durationMs = clock->nowMs() - startMs;
+  if (report.durationMs > 0) {
+    report.entriesPerSecond = report.entries * 1000.0f / report.durationMs;
+  }
+  return report;
+}
+
+void LogDownloader::pause() {
+  pauseRequested = true;
+}
+
+LogDownloadState LogDownloader::getState() const {
+  return state;
+}
+
+LogDownloadCheckpoint LogDownloader::getCheckpoint() const {
+  return checkpoint;
+}
+
+void LogDownloader::setCheckpoint(const LogDownloadCheckpoint& restored) {
+  checkpoint = restored;
+  if (state == LogDownloadState::Idle) {
+    state = LogDownloadState::Paused;
+  }
+}
+
+bool LogDownloader::nextChunk(uint32_t* startIndex, uint16_t* count) const {
+  uint32_t remaining = UINT32_MAX;
+  if (options.maxEntries > 0) {
+    if (checkpoint.delivered >= options.maxEntries) {
+      return false;
+    }
+    remaining = options.maxEntries - checkpoint.delivered;
+  }
+  if (checkpoint.total >= 0 && options.startIndex == 0) {
+    if (checkpoint.delivered >= (uint32_t)checkpoint.total) {
+      return false;
+    }
+    remaining = std::min(remaining, (uint32_t)checkpoint.total - checkpoint.delivered);
+  }
+
+  if (checkpoint.started && options.sortOrder != 0 && checkpoint.lastIndex <= 1) {
+    //descending past the first entry
+    return false;
+  }
+  *startIndex = nextIndex();
+  *count = (uint16_t)std::min(remaining, (uint32_t)options.chunkSize);
+  return true;
+}
+
+bool LogDownloader::awaitChunk(const uint32_t receivedBefore, const uint16_t count) {
+  Nuki::Clock* clock = lock->getClock();
+  uint32_t received = 0;
+  uint32_t lastProgressMs = clock->nowMs();
+  while (true) {
+    uint32_t now = lock->getLogEntriesReceived() - receivedBefore;
+    if (now >= count) {
+      return true;
+    }
+    if (now != received) {
+      received = now;
+      lastProgressMs = clock->nowMs();
+    } else if (clock->nowMs() - lastProgressMs >= options.idleTimeoutMs) {
+      return false;
+    }
+    clock->sleepMs(NUKI_LOG_DOWNLOAD_POLL);
+  }
+}
+
+uint16_t LogDownloader::deliver(EntryCallback& callback, LogDownloadReport& report, bool* gap) {
+  std::list<LogEntry> entries;
+  lock->getLogEntries(&entries);
+
+  *gap = false;
+  uint16_t delivered = 0;
+  for (const LogEntry& entry : entries) {
+    uint32_t expected = nextIndex();
+    if (isDelivered(entry.index)) {
+      report.duplicates++;
+      continue;
+    }
+    if (expected != 0 && entry.index != expected) {
+      //the entries after a lost one are requested again, the checkpoint never skips an index
+      *gap = true;
+      break;
+    }
+    checkpoint.started = true;
+    checkpoint.lastIndex = entry.index;
+    checkpoint.delivered++;
+    delivered++;
+    if (callback) {
+      callback(entry);
+    }
+  }
+  return delivered;
+}
+
+uint32_t LogDownloader::nextIndex() const {
+  if (!checkpoint.started) {
+    return options.startIndex;
+  }
+  return options.sortOrder == 0 ? checkpoint.lastIndex + 1 : checkpoint.lastIndex - 1;
+}
+
+bool LogDownloader::isDelivered(const uint32_t index) const {
+  if (!checkpoint.started) {
+    return false;
+  }
+  return options.sortOrder == 0 ? index <= checkpoint.lastIndex : index >= checkpoint.lastIndex;
+}
+
+} // namespace NukiLock
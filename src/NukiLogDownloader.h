@@ -0,0 +1,132 @@
+#pragma once
+/**
+ * @file NukiLogDownloader.h
+ * Chunked, resumable download of the lock's log
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiLock.h"
+#include <functional>
+
+#ifndef NUKI_LOG_DOWNLOAD_IDLE_TIMEOUT
+#define NUKI_LOG_DOWNLOAD_IDLE_TIMEOUT 2000
+#endif
+#ifndef NUKI_LOG_DOWNLOAD_POLL
+#define NUKI_LOG_DOWNLOAD_POLL 20
+#endif
+
+namespace NukiLock {
+
+enum class LogDownloadState : uint8_t {
+  Idle,                             //begin() not called yet
+  Running,
+  Paused,                           //begin() or pause() was called, run() continues from the checkpoint
+  Complete,
+  Failed                            //retries of a chunk exhausted, run() resumes
+};
+
+struct LogDownloadOptions {
+  uint16_t chunkSize = 20;          //entries requested per retrieveLogEntries() call
+  uint8_t sortOrder = 0;            //0 ascending, 1 descending
+  uint32_t startIndex = 0;          //index of the first entry, 0 = start of the log in sort order
+  uint32_t maxEntries = 0;          //0 = whole log
+  uint8_t maxRetries = 3;           //per chunk, backoff of the device's RetryPolicy
+  uint32_t idleTimeoutMs = NUKI_LOG_DOWNLOAD_IDLE_TIMEOUT; //chunk ends when no entry arrived for this time
+};
+
+/**
+ * @brief Progress of a download, can be persisted and restored with setCheckpoint() to resume after a restart
+ */
+struct LogDownloadCheckpoint {
+  bool started;                     //lastIndex is valid
+  uint32_t lastIndex;               //index of the last delivered entry
+  uint32_t delivered;               //entries delivered since begin()
+  int32_t total;                    //entries in the log as reported by the lock, -1 if unknown
+};
+
+struct LogDownloadReport {
+  LogDownloadState state;
+  Nuki::CmdResult lastResult;       //result of the last retrieveLogEntries() call
+  uint32_t entries;                 //entries delivered by this run
+  uint32_t duplicates;              //entries received again and skipped
+  uint16_t gaps;                    //chunks requested again from the checkpoint because an entry in between was lost
+  uint16_t chunks;
+  uint16_t retries;
+  uint32_t durationMs;
+  float entriesPerSecond;
+};
+
+/**
+ * @brief Downloads the log in chunks of options.chunkSize entries and checkpoints the index of the last delivered
+ * entry. Log indices are consecutive, entries are only delivered in index order: after a lost entry the rest of
+ * the chunk is dropped and requested again from the checkpoint, like a chunk interrupted by a disconnect, timeout
+ * or lock busy. Entries already delivered are skipped. Between chunks the BLE semaphore is free, so other callers are served with at
+ * most one chunk of delay; pause() stops after the current chunk and run() continues where it stopped.
+ *
+ *     NukiLock::LogDownloader downloader(&nukiLock);
+ *     downloader.begin();
+ *     LogDownloadReport report = downloader.run([](const NukiLock::LogEntry& entry) {
+ *       log_d("Log[%d]", entry.index);
+ *     });
+ */
+class LogDownloader {
+  public:
+    typedef std::function<void(const LogEntry& entry)> EntryCallback;
+
+    explicit LogDownloader(NukiLock* lock);
+
+    /**
+     * @brief Starts a new download, the checkpoint is reset
+     */
+    void begin(const LogDownloadOptions& options = LogDownloadOptions());
+
+    /**
+     * @brief Downloads until the log is complete, a chunk failed options.maxRetries times or pause() was called.
+     * Blocks the calling task, callback is called in log order from this task.
+     */
+    LogDownloadReport run(EntryCallback callback);
+
+    /**
+     * @brief Makes run() return after the current chunk, can be called from any task
+     */
+    void pause();
+
+    LogDownloadState getState() const;
+    LogDownloadCheckpoint getCheckpoint() const;
+
+    /**
+     * @brief Restores a persisted checkpoint of a download started with the same options
+     */
+    void setCheckpoint(const LogDownloadCheckpoint& checkpoint);
+
+  private:
+    /**
+     * @return false if the checkpoint reached the end of the log in sort order
+     */
+    bool nextChunk(uint32_t* startIndex, uint16_t* count) const;
+    bool awaitChunk(const uint32_t receivedBefore, const uint16_t count);
+    /**
+     * @param gap set if an entry was missing, the entries after it are not delivered
+     */
+    uint16_t deliver(EntryCallback& callback, LogDownloadReport& report, bool* gap);
+    /**
+     * @brief Index of the next entry in sort order, options.startIndex (0 = unknown) before the first entry
+     */
+    uint32_t nextIndex() const;
+    bool isDelivered(const uint32_t index) const;
+
+    NukiLock* lock;
+    LogDownloadOptions options;
+    LogDownloadCheckpoint checkpoint = {false, 0, 0, -1};
+    std::atomic<LogDownloadState> state{LogDownloadState::Idle};
+    std::atomic<bool> pauseRequested{false};
+};
+
+} // namespace NukiLock
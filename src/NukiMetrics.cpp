@@ -0,0 +1,192 @@
+/**
+ * @file NukiMetrics.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiMetrics.h"
+
+namespace Nuki {
+
+void MetricsCounters::recordCommand(const Command command, const CmdResult result) {
+  portENTER_CRITICAL(&mux);
+  CommandResultCounts* counts = nullptr;
+  for (uint8_t i = 0; i < nrOfCommands; i++) {
+    if (commands[i].command == command) {
+      counts = &commands[i];
+      break;
+    }
+  }
+  if (counts == nullptr && nrOfCommands < NUKI_METRICS_COMMAND_SLOTS) {
+    counts = &commands[nrOfCommands++];
+    counts->command = command;
+  }
+  if (counts != nullptr) {
+    switch (result) {
+      case CmdResult::Success:
+        counts->success++;
+        break;
+      case CmdResult::Failed:
+        counts->failed++;
+        break;
+      case CmdResult::TimeOut:
+        counts->timeOut++;
+        break;
+      case CmdResult::NotPaired:
+        counts->notPaired++;
+        break;
+      case CmdResult::Lock_Busy:
+        counts->lockBusy++;
+        break;
+      case CmdResult::DeadlineExceeded:
+        counts->deadlineExceeded++;
+        break;
+      default:
+        counts->error++;
+        break;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+void MetricsCounters::recordSemaphoreWait(const uint32_t waitUs, const bool acquired) {
+  portENTER_CRITICAL(&mux);
+  semaphoreWaitUs += waitUs;
+  if (acquired) {
+    semaphoreAcquisitions++;
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+void MetricsCounters::recordProfileSession(const ConnectionProfile profile, const uint16_t mtu, const uint16_t connInterval) {
+  portENTER_CRITICAL(&mux);
+  ConnectionProfileStats& stats = profiles[(uint8_t)profile];
+  stats.sessions++;
+  stats.mtu = mtu;
+  stats.connInterval = connInterval;
+  portEXIT_CRITICAL(&mux);
+}
+
+void MetricsCounters::recordProfileTransfer(const ConnectionProfile profile, const uint32_t messages, const uint32_t transferMs) {
+  portENTER_CRITICAL(&mux);
+  ConnectionProfileStats& stats = profiles[(uint8_t)profile];
+  stats.messagesReceived += messages;
+  stats.transferMs += transferMs;
+  portEXIT_CRITICAL(&mux);
+}
+
+void MetricsCounters::snapshot(NukiMetrics* metrics) const {
+  portENTER_CRITICAL(&mux);
+  memcpy(metrics->commands, commands, sizeof(commands));
+  metrics->nrOfCommands = nrOfCommands;
+  metrics->semaphoreAcquisitions = semaphoreAcquisitions;
+  metrics->semaphoreWaitUs = semaphoreWaitUs;
+  memcpy(metrics->profiles, profiles, sizeof(profiles));
+  portEXIT_CRITICAL(&mux);
+
+  metrics->connectAttempts = connectAttempts.load(std::memory_order_relaxed);
+  metrics->connectRetries = connectRetries.load(std::memory_order_relaxed);
+  metrics->connectFailures = connectFailures.load(std::memory_order_relaxed);
+  metrics->connectAdvertSyncs = connectAdvertSyncs.load(std::memory_order_relaxed);
+  metrics->connectAdvertMisses = connectAdvertMisses.load(std::memory_order_relaxed);
+  metrics->crcFailures = crcFailures.load(std::memory_order_relaxed);
+  metrics->decryptFailures = decryptFailures.load(std::memory_order_relaxed);
+  metrics->lockBusy = lockBusy.load(std::memory_order_relaxed);
+  metrics->heartbeatTimeouts = heartbeatTimeouts.load(std::memory_order_relaxed);
+  metrics->semaphoreTimeouts = semaphoreTimeouts.load(std::memory_order_relaxed);
+  metrics->commandRetries = commandRetries.load(std::memory_order_relaxed);
+  metrics->advertsProcessed = advertsProcessed.load(std::memory_order_relaxed);
+}
+
+static void appendCounter(std::string& out, const char* name, const std::string& deviceName, const uint32_t value) {
+  char line[160];
+  snprintf(line, sizeof(line), "# TYPE nuki_%s counter\nnuki_%s{device=\"%s\"} %u\n",
+           name, name, deviceName.c_str(), value);
+  out += line;
+}
+
+static void appendProfileSamples(std::string& out, const char* name, const char* type, const std::string& deviceName,
+                                 const double values[CONNECTION_PROFILE_COUNT]) {
+  char line[160];
+  snprintf(line, sizeof(line), "# TYPE nuki_%s %s\n", name, type);
+  out += line;
+  for (uint8_t i = 0; i < CONNECTION_PROFILE_COUNT; i++) {
+    snprintf(line, sizeof(line), "nuki_%s{device=\"%s\",profile=\"%s\"} %g\n",
+             name, deviceName.c_str(), connectionProfileName((ConnectionProfile)i), values[i]);
+    out += line;
+  }
+}
+
+std::string metricsToPrometheus(const NukiMetrics& metrics, const std::string& deviceName) {
+  std::string out;
+  out.reserve(2048 + metrics.nrOfCommands * 7 * 96);
+
+  out += "# TYPE nuki_commands_total counter\n";
+  const char* resultNames[] = {"success", "failed", "timeout", "not_paired", "lock_busy", "deadline_exceeded", "error"};
+  char line[160];
+  for (uint8_t i = 0; i < metrics.nrOfCommands; i++) {
+    const CommandResultCounts& counts = metrics.commands[i];
+    const uint32_t values[] = {counts.success, counts.failed, counts.timeOut, counts.notPaired, counts.lockBusy,
+                               counts.deadlineExceeded, counts.error
+                              };
+    for (uint8_t r = 0; r < 7; r++) {
+      if (values[r] == 0) {
+        continue;
+      }
+      snprintf(line, sizeof(line), "nuki_commands_total{device=\"%s\",command=\"0x%04x\",result=\"%s\"} %u\n",
+               deviceName.c_str(), (uint16_t)counts.command, resultNames[r], values[r]);
+      out += line;
+    }
+  }
+
+  appendCounter(out, "coalesced_requests_total", deviceName, metrics.coalescedRequests);
+  appendCounter(out, "connect_attempts_total", deviceName, metrics.connectAttempts);
+  appendCounter(out, "connect_retries_total", deviceName, metrics.connectRetries);
+  appendCounter(out, "connect_failures_total", deviceName, metrics.connectFailures);
+  appendCounter(out, "connect_advert_syncs_total", deviceName, metrics.connectAdvertSyncs);
+  appendCounter(out, "connect_advert_misses_total", deviceName, metrics.connectAdvertMisses);
+  snprintf(line, sizeof(line), "# TYPE nuki_advertising_interval_seconds gauge\nnuki_advertising_interval_seconds{device=\"%s\"} %.3f\n",
+           deviceName.c_str(), metrics.advertisingIntervalMs / 1000.0);
+  out += line;
+  appendCounter(out, "crc_failures_total", deviceName, metrics.crcFailures);
+  appendCounter(out, "decrypt_failures_total", deviceName, metrics.decryptFailures);
+  appendCounter(out, "lock_busy_total", deviceName, metrics.lockBusy);
+  appendCounter(out, "heartbeat_timeouts_total", deviceName, metrics.heartbeatTimeouts);
+  appendCounter(out, "semaphore_timeouts_total", deviceName, metrics.semaphoreTimeouts);
+  appendCounter(out, "semaphore_acquisitions_total", deviceName, metrics.semaphoreAcquisitions);
+  appendCounter(out, "command_retries_total", deviceName, metrics.commandRetries);
+  snprintf(line, sizeof(line), "# TYPE nuki_semaphore_wait_seconds_total counter\nnuki_semaphore_wait_seconds_total{device=\"%s\"} %.6f\n",
+           deviceName.c_str(), metrics.semaphoreWaitUs / 1000000.0);
+  out += line;
+  appendCounter(out, "adverts_processed_total", deviceName, metrics.advertsProcessed);
+  appendCounter(out, "notifications_processed_total", deviceName, metrics.notificationsProcessed);
+  appendCounter(out, "notification_overflows_total", deviceName, metrics.notificationOverflows);
+
+  double sessions[CONNECTION_PROFILE_COUNT];
+  double messages[CONNECTION_PROFILE_COUNT];
+  double transferSeconds[CONNECTION_PROFILE_COUNT];
+  double mtu[CONNECTION_PROFILE_COUNT];
+  double intervalSeconds[CONNECTION_PROFILE_COUNT];
+  for (uint8_t i = 0; i < CONNECTION_PROFILE_COUNT; i++) {
+    const ConnectionProfileStats& profile = metrics.profiles[i];
+    sessions[i] = profile.sessions;
+    messages[i] = profile.messagesReceived;
+    transferSeconds[i] = profile.transferMs / 1000.0;
+    mtu[i] = profile.mtu;
+    intervalSeconds[i] = profile.connInterval * 0.00125;
+  }
+  appendProfileSamples(out, "profile_sessions_total", "counter", deviceName, sessions);
+  appendProfileSamples(out, "profile_messages_received_total", "counter", deviceName, messages);
+  appendProfileSamples(out, "profile_transfer_seconds_total", "counter", deviceName, transferSeconds);
+  appendProfileSamples(out, "profile_mtu", "gauge", deviceName, mtu);
+  appendProfileSamples(out, "profile_conn_interval_seconds", "gauge", deviceName, intervalSeconds);
+  return out;
+}
+
+} // namespace Nuki
@@ -0,0 +1,109 @@
+#pragma once
+/**
+ * @file NukiMetrics.h
+ * Protocol health counters and their text export
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include "NukiDataTypes.h"
+#include "NukiConnectionProfile.h"
+#include <atomic>
+#include <string>
+
+#ifndef NUKI_METRICS_COMMAND_SLOTS
+#define NUKI_METRICS_COMMAND_SLOTS 16
+#endif
+
+namespace Nuki {
+
+struct CommandResultCounts {
+  Command command;
+  uint32_t success;
+  uint32_t failed;
+  uint32_t timeOut;
+  uint32_t notPaired;
+  uint32_t lockBusy;
+  uint32_t deadlineExceeded;
+  uint32_t error;
+};
+
+struct NukiMetrics {
+  CommandResultCounts commands[NUKI_METRICS_COMMAND_SLOTS];
+  uint8_t nrOfCommands;           //used entries in commands
+  uint32_t coalescedRequests;
+  uint32_t connectAttempts;
+  uint32_t connectRetries;
+  uint32_t connectFailures;
+  uint32_t connectAdvertSyncs;    //connect attempts started right after an advertisement (setConnectOnAdvertisement())
+  uint32_t connectAdvertMisses;   //connect attempts started after waiting in vain for an advertisement
+  uint32_t advertisingIntervalMs; //learned advertising interval of the lock, 0 if unknown
+  uint32_t crcFailures;
+  uint32_t decryptFailures;
+  uint32_t lockBusy;              //error reports with error code 69 (lock busy)
+  uint32_t heartbeatTimeouts;     //commands rejected because no advertisement was received within HEARTBEAT_TIMEOUT
+  uint32_t semaphoreTimeouts;
+  uint32_t commandRetries;
+  uint32_t semaphoreAcquisitions;
+  uint64_t semaphoreWaitUs;       //total time spent waiting for the BLE semaphore, including timed out attempts
+  uint32_t advertsProcessed;
+  uint32_t notificationsProcessed;
+  uint32_t notificationOverflows;
+  ConnectionProfileStats profiles[CONNECTION_PROFILE_COUNT]; //indexed by ConnectionProfile, updated when a profile is left
+};
+
+/**
+ * @brief Counters updated from the BLE, notification and command tasks. Simple counters are relaxed atomics,
+ * per command counters are kept in a fixed table guarded by a short critical section.
+ */
+class MetricsCounters {
+  public:
+    void recordCommand(const Command command, const CmdResult result);
+    void recordSemaphoreWait(const uint32_t waitUs, const bool acquired);
+    void recordProfileSession(const ConnectionProfile profile, const uint16_t mtu, const uint16_t connInterval);
+    void recordProfileTransfer(const ConnectionProfile profile, const uint32_t messages, const uint32_t transferMs);
+
+    /**
+     * @brief Copies all counters, the copy is not atomic as a whole but every single counter is consistent
+     */
+    void snapshot(NukiMetrics* metrics) const;
+
+    std::atomic<uint32_t> connectAttempts{0};
+    std::atomic<uint32_t> connectRetries{0};
+    std::atomic<uint32_t> connectFailures{0};
+    std::atomic<uint32_t> connectAdvertSyncs{0};
+    std::atomic<uint32_t> connectAdvertMisses{0};
+    std::atomic<uint32_t> crcFailures{0};
+    std::atomic<uint32_t> decryptFailures{0};
+    std::atomic<uint32_t> lockBusy{0};
+    std::atomic<uint32_t> heartbeatTimeouts{0};
+    std::atomic<uint32_t> semaphoreTimeouts{0};
+    std::atomic<uint32_t> commandRetries{0};
+    std::atomic<uint32_t> advertsProcessed{0};
+
+  private:
+    CommandResultCounts commands[NUKI_METRICS_COMMAND_SLOTS] = {};
+    uint8_t nrOfCommands = 0;
+    uint32_t semaphoreAcquisitions = 0;
+    uint64_t semaphoreWaitUs = 0;
+    ConnectionProfileStats profiles[CONNECTION_PROFILE_COUNT] = {};
+    mutable portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+/**
+ * @brief Serializes metrics in the Prometheus text exposition format, every sample is labeled with the device name
+ *
+ * @param metrics snapshot to serialize
+ * @param deviceName value of the device label
+ * @return text to be served on a /metrics endpoint
+ */
+std::string metricsToPrometheus(const NukiMetrics& metrics, const std::string& deviceName);
+
+} // namespace Nuki
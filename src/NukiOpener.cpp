@@ -13,6 +13,10 @@ NukiOpener::NukiOpener(const std::string& deviceName, const uint32_t deviceId)
             deviceName + "opener") {
 }
 
+NukiOpener::~NukiOpener() {
+  stopTasks();
+}
+
 Nuki::CmdResult NukiOpener::lockAction(const LockAction lockAction, const uint32_t nukiAppId, const uint8_t flags, const char* nameSuffix, const uint8_t nameSuffixLen) {
   Action action;
   unsigned char payload[5 + nameSuffixLen] = {0};
@@ -48,13 +52,31 @@ Nuki::CmdResult NukiOpener::requestOpenerState(OpenerState* state) {
   Nuki::CmdResult result = executeAction(action);
   if (result == Nuki::CmdResult::Success) {
     // printBuffer((byte*)&retrievedKeyTurnerState, sizeof(retrievedKeyTurnerState), false, "retreived Keyturner state");
-    memcpy(state, &openerState, sizeof(OpenerState));
+    *state = openerStateSnapshot.read();
   }
   return result;
 }
 
+Nuki::CmdResult NukiOpener::requestOpenerState(OpenerState* state, const uint32_t maxAgeMs, const bool allowStale) {
+  if (isStateFresh(maxAgeMs)) {
+    *state = openerStateSnapshot.read();
+    return Nuki::CmdResult::Success;
+  }
+  if (allowStale && hasStateReceived()) {
+    refreshStateInBackground();
+    *state = openerStateSnapshot.read();
+    return Nuki::CmdResult::Success;
+  }
+  return requestOpenerState(state);
+}
+
+Nuki::CmdResult NukiOpener::refreshState() {
+  OpenerState state;
+  return requestOpenerState(&state);
+}
+
 void NukiOpener::retrieveOpenerState(OpenerState* state) {
-  memcpy(state, &openerState, sizeof(OpenerState));
+  *state = openerStateSnapshot.read();
 }
 
 
@@ -76,6 +98,12 @@ Nuki::CmdResult NukiOpener::requestBatteryReport(BatteryReport* retrievedBattery
 
 
 Nuki::CmdResult NukiOpener::requestConfig(Config* retrievedConfig) {
+  uint32_t cacheGeneration = getConfigCacheGeneration();
+  if (configCachedAt == cacheGeneration) {
+    *retrievedConfig = configCache.read();
+    return Nuki::CmdResult::Success;
+  }
+
   Action action;
 
   action.cmdType = Nuki::CommandType::CommandWithChallenge;
@@ -84,11 +112,19 @@ Nuki::CmdResult NukiOpener::requestConfig(Config* retrievedConfig) {
   Nuki::CmdResult result = executeAction(action);
   if (result == Nuki::CmdResult::Success) {
     memcpy(retrievedConfig, &config, sizeof(Config));
+    configCache.write(*retrievedConfig);
+    configCachedAt = cacheGeneration;
   }
   return result;
 }
 
 Nuki::CmdResult NukiOpener::requestAdvancedConfig(AdvancedConfig* retrievedAdvancedConfig) {
+  uint32_t cacheGeneration = getConfigCacheGeneration();
+  if (advancedConfigCachedAt == cacheGeneration) {
+    *retrievedAdvancedConfig = advancedConfigCache.read();
+    return Nuki::CmdResult::Success;
+  }
+
   Action action;
 
   action.cmdType = Nuki::CommandType::CommandWithChallenge;
@@ -97,22 +133,24 @@ Nuki::CmdResult NukiOpener::requestAdvancedConfig(AdvancedConfig* retrievedAdvan
   Nuki::CmdResult result = executeAction(action);
   if (result == Nuki::CmdResult::Success) {
     memcpy(retrievedAdvancedConfig, &advancedConfig, sizeof(AdvancedConfig));
+    advancedConfigCache.write(*retrievedAdvancedConfig);
+    advancedConfigCachedAt = cacheGeneration;
   }
   return result;
 }
 
+NukiOpener::ConfigTransaction NukiOpener::beginConfigTransaction() {
+  return ConfigTransaction(*this);
+}
+
 
 //basic config change methods
 Nuki::CmdResult NukiOpener::setName(const std::string& name) {
 
   if (name.length() <= 32) {
-    Config oldConfig;
-    Nuki::CmdResult result = requestConfig(&oldConfig);
-    if (result == Nuki::CmdResult::Success) {
-      memcpy(oldConfig.name, name.c_str(), name.length());
-      result = setFromConfig(oldConfig);
-    }
-    return result;
+    ConfigTransaction transaction = beginConfigTransaction();
+    memcpy(transaction.config().name, name.c_str(), name.length());
+    return transaction.commit();
   } else {
     log_w("setName, too long (max32)");
     return Nuki::CmdResult::Failed;
@@ -121,127 +159,79 @@ Nuki::CmdResult NukiOpener::setName(const std::string& name) {
 
 
 Nuki::CmdResult NukiOpener::enableDst(const bool enable) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.dstMode = enable;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().dstMode = enable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiOpener::setTimeZoneOffset(const int16_t minutes) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.timeZoneOffset = minutes;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().timeZoneOffset = minutes;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiOpener::setTimeZoneId(const TimeZoneId timeZoneId) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.timeZoneId = timeZoneId;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().timeZoneId = timeZoneId;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiOpener::enableButton(const bool enable) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.buttonEnabled = enable;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().buttonEnabled = enable;
+  return transaction.commit();
 }
 
 
 //advanced config change methods
 Nuki::CmdResult NukiOpener::setSingleButtonPressAction(const ButtonPressAction action) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.singleButtonPressAction = action;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().singleButtonPressAction = action;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiOpener::setDoubleButtonPressAction(const ButtonPressAction action) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.doubleButtonPressAction = action;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().doubleButtonPressAction = action;
+  return transaction.commit();
 }
 
 
 
 Nuki::CmdResult NukiOpener::setBatteryType(const BatteryType type) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.batteryType = type;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().batteryType = type;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiOpener::enableAutoBatteryTypeDetection(const bool enable) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.automaticBatteryTypeDetection = enable;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().automaticBatteryTypeDetection = enable;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiOpener::enablePairing(const bool enable) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.pairingEnabled = enable;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().pairingEnabled = enable;
+  return transaction.commit();
 }
 
 CmdResult NukiOpener::enableLedFlash(const bool enable) {
-  Config oldConfig;
-  CmdResult result = requestConfig(&oldConfig);
-  if (result == CmdResult::Success) {
-    oldConfig.ledFlashEnabled = enable;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().ledFlashEnabled = enable;
+  return transaction.commit();
 }
 
 CmdResult NukiOpener::setSoundLevel(const uint8_t value) {
-  AdvancedConfig oldConfig;
-  Nuki::CmdResult result = requestAdvancedConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.soundLevel = value;
-    result = setFromAdvancedConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.advancedConfig().soundLevel = value;
+  return transaction.commit();
 }
 
 Nuki::CmdResult NukiOpener::setAdvertisingMode(const AdvertisingMode mode) {
-  Config oldConfig;
-  Nuki::CmdResult result = requestConfig(&oldConfig);
-  if (result == Nuki::CmdResult::Success) {
-    oldConfig.advertisingMode = mode;
-    result = setFromConfig(oldConfig);
-  }
-  return result;
+  ConfigTransaction transaction = beginConfigTransaction();
+  transaction.config().advertisingMode = mode;
+  return transaction.commit();
 }
 
 
@@ -333,6 +323,7 @@ void NukiOpener::getLogEntries(std::list<LogEntry>* requestedLogEntries) {
 }
 
 Nuki::CmdResult NukiOpener::retrieveLogEntries(const uint32_t startIndex, const uint16_t count, const uint8_t sortOrder, bool const totalCount) {
+  Nuki::ConnectionProfileScope bulkTransfer(Nuki::ConnectionProfile::Bulk);
   Action action;
   unsigned char payload[8] = {0};
   memcpy(payload, &startIndex, 4);
@@ -351,7 +342,7 @@ Nuki::CmdResult NukiOpener::retrieveLogEntries(const uint32_t startIndex, const
 }
 
 bool NukiOpener::isBatteryCritical() {
-  return openerState.criticalBatteryState & 1;
+  return openerStateSnapshot.read().criticalBatteryState & 1;
 }
 
 const ErrorCode NukiOpener::getLastError() const {
@@ -368,7 +359,9 @@ Nuki::CmdResult NukiOpener::setConfig(NewConfig newConfig) {
   memcpy(action.payload, &payload, sizeof(payload));
   action.payloadLen = sizeof(payload);
 
-  return executeAction(action);
+  Nuki::CmdResult result = executeAction(action);
+  invalidateConfigCache();
+  return result;
 }
 
 Nuki::CmdResult NukiOpener::setFromConfig(const Config config) {
@@ -393,7 +386,9 @@ Nuki::CmdResult NukiOpener::setAdvancedConfig(NewAdvancedConfig newAdvancedConfi
   memcpy(action.payload, &payload, sizeof(payload));
   action.payloadLen = sizeof(payload);
 
-  return executeAction(action);
+  Nuki::CmdResult result = executeAction(action);
+  invalidateConfigCache();
+  return result;
 }
 
 void NukiOpener::createNewConfig(const Config* oldConfig, NewConfig* newConfig) {
@@ -444,10 +439,15 @@ void NukiOpener::handleReturnMessage(Command returnCode, unsigned char* data, ui
   switch (returnCode) {
     case Command::KeyturnerStates : {
       printBuffer((byte*)data, dataLen, false, "keyturnerStates");
+      OpenerState previousState = openerState;
       memcpy(&openerState, data, sizeof(openerState));
+      openerStateSnapshot.write(openerState);
+      markStateReceived();
+      updateConfigUpdateCount(openerState.configUpdateCount);
       #ifdef DEBUG_NUKI_READABLE_DATA
       logKeyturnerState(openerState);
       #endif
+      publishStateEvents(previousState, openerState);
       break;
     }
     case Command::BatteryReport : {
@@ -489,6 +489,11 @@ void NukiOpener::handleReturnMessage(Command returnCode, unsigned char* data, ui
       #ifdef DEBUG_NUKI_READABLE_DATA
       logLogEntry(logEntry);
       #endif
+      Event event;
+      event.type = logEntry.loggingType == LoggingType::DoorbellRecognition ? EventType::OpenerRing : EventType::NewLogEntry;
+      event.logEntry.index = logEntry.index;
+      event.logEntry.loggingType = (uint8_t)logEntry.loggingType;
+      publishEvent(event);
       break;
     }
     default:
@@ -497,6 +502,47 @@ void NukiOpener::handleReturnMessage(Command returnCode, unsigned char* data, ui
   lastMsgCodeReceived = returnCode;
 }
 
+void NukiOpener::publishStateEvents(const OpenerState& previous, const OpenerState& current) {
+  if (!openerStateReceived) {
+    //first state received is the baseline for transitions and the field diff
+    openerStateReceived = true;
+    return;
+  }
+  Event event;
+  if (previous.lockState != current.lockState) {
+    event.type = EventType::LockStateChanged;
+    event.stateChange.previous = (uint8_t)previous.lockState;
+    event.stateChange.current = (uint8_t)current.lockState;
+    publishEvent(event);
+  }
+  if (previous.doorSensorState != current.doorSensorState) {
+    event.type = EventType::DoorSensorStateChanged;
+    event.stateChange.previous = (uint8_t)previous.doorSensorState;
+    event.stateChange.current = (uint8_t)current.doorSensorState;
+    publishEvent(event);
+  }
+  if ((current.criticalBatteryState & 0x01) && !(previous.criticalBatteryState & 0x01)) {
+    event.type = EventType::BatteryCritical;
+    event.battery.criticalBatteryState = current.criticalBatteryState;
+    event.battery.percentage = 0;
+    publishEvent(event);
+  }
+
+  publishFieldChange(StateField::NukiState, (int32_t)previous.nukiState, (int32_t)current.nukiState);
+  publishFieldChange(StateField::LockState, (int32_t)previous.lockState, (int32_t)current.lockState);
+  publishFieldChange(StateField::Trigger, (int32_t)previous.trigger, (int32_t)current.trigger);
+  publishFieldChange(StateField::TimeZoneOffset, previous.timeZoneOffset, current.timeZoneOffset);
+  publishFieldChange(StateField::CriticalBatteryState, previous.criticalBatteryState, current.criticalBatteryState);
+  publishFieldChange(StateField::BatteryCritical, previous.criticalBatteryState & 0x01, current.criticalBatteryState & 0x01);
+  publishFieldChange(StateField::ConfigUpdateCount, previous.configUpdateCount, current.configUpdateCount);
+  publishFieldChange(StateField::RingToOpenTimer, previous.ringToOpenTimer, current.ringToOpenTimer);
+  publishFieldChange(StateField::LastLockAction, (int32_t)previous.lastLockAction, (int32_t)current.lastLockAction);
+  publishFieldChange(StateField::LastLockActionTrigger, (int32_t)previous.lastLockActionTrigger, (int32_t)current.lastLockActionTrigger);
+  publishFieldChange(StateField::LastLockActionCompletionStatus, (int32_t)previous.lastLockActionCompletionStatus,
+                     (int32_t)current.lastLockActionCompletionStatus);
+  publishFieldChange(StateField::DoorSensorState, (int32_t)previous.doorSensorState, (int32_t)current.doorSensorState);
+}
+
 void NukiOpener::logErrorCode(uint8_t errorCode) {
   logOpenerErrorCode(errorCode);
 }
@@ -1,13 +1,19 @@
 #pragma once
 
 #include "NukiBle.h"
+#include "NukiConfigTransaction.h"
 #include "NukiOpenerConstants.h"
 
 namespace NukiOpener {
 
 class NukiOpener : public Nuki::NukiBle {
+    friend class Nuki::ConfigTransaction<NukiOpener, Config, AdvancedConfig>;
+
   public:
+    typedef Nuki::ConfigTransaction<NukiOpener, Config, AdvancedConfig> ConfigTransaction;
+
     NukiOpener(const std::string& deviceName, const uint32_t deviceId);
+    virtual ~NukiOpener();
 
     /**
      * @brief Sends lock action cmd via BLE to the lock
@@ -31,7 +37,18 @@ class NukiOpener : public Nuki::NukiBle {
     Nuki::CmdResult requestOpenerState(OpenerState* state);
 
     /**
-     * @brief Gets the last keyturner state stored on the esp
+     * @brief Returns the stored state if it is not older than maxAgeMs, otherwise requests it via BLE.
+     * Callers polling the same device share one BLE exchange within the freshness bound
+     *
+     * @param state Nuki api based datatype to store the retrieved state
+     * @param maxAgeMs maximum age in milliseconds of the stored state to be returned without BLE request
+     * @param allowStale if true an outdated state is returned immediately and refreshed in a background task,
+     * only if no state has been received at all the request is done synchronously
+     */
+    Nuki::CmdResult requestOpenerState(OpenerState* state, const uint32_t maxAgeMs, const bool allowStale = false);
+
+    /**
+     * @brief Gets the last keyturner state stored on the esp, lock-free and safe to call from any task
      *
      * @param openerState Nuki api based datatype to store the retrieved keyturnerstate
      */
@@ -211,19 +228,31 @@ class NukiOpener : public Nuki::NukiBle {
                                        const bool totalCount);
 
     /**
-     * @brief Requests config from Lock via BLE
+     * @brief Requests config from Lock via BLE, a cached copy is returned without BLE request as long as
+     * the configUpdateCount in the received keyturner state has not changed and no config has been written.
+     * The currentTime fields of a cached config hold the device time when the config was read, the current
+     * device time is part of the opener state
      *
      * @param retrievedConfig Nuki api based datatype to store the retrieved config
      */
     Nuki::CmdResult requestConfig(Config* retrievedConfig);
 
     /**
-     * @brief Requests advanced config from Lock via BLE
+     * @brief Requests advanced config from Lock via BLE, a cached copy is returned without BLE request as long as
+     * the configUpdateCount in the received keyturner state has not changed and no config has been written
      *
      * @param retrievedAdvancedConfig Nuki api based datatype to store the retrieved advanced config
      */
     Nuki::CmdResult requestAdvancedConfig(AdvancedConfig* retrievedAdvancedConfig);
 
+    /**
+     * @brief Starts a config transaction, edits of config and advanced config are collected and
+     * written with one command per config on commit(), unchanged configs are not written
+     *
+     * @return transaction bound to this device
+     */
+    ConfigTransaction beginConfigTransaction();
+
 
     /**
      * @brief Returns battery critical state parsed from the battery state byte (battery critical byte)
@@ -242,6 +271,7 @@ class NukiOpener : public Nuki::NukiBle {
     virtual void logErrorCode(uint8_t errorCode) override;
 
   protected:
+    Nuki::CmdResult refreshState() override;
     void handleReturnMessage(Command returnCode, unsigned char* data, uint16_t dataLen) override;
 
 
@@ -252,14 +282,21 @@ class NukiOpener : public Nuki::NukiBle {
     void createNewConfig(const Config* oldConfig, NewConfig* newConfig);
     void createNewAdvancedConfig(const AdvancedConfig* oldConfig, NewAdvancedConfig* newConfig);
     Nuki::CmdResult setFromAdvancedConfig(const AdvancedConfig config);
+    void publishStateEvents(const OpenerState& previous, const OpenerState& current);
 
-    OpenerState openerState;
+    OpenerState openerState;  //only accessed from the notification task, other tasks read openerStateSnapshot
+    Nuki::SeqLock<OpenerState> openerStateSnapshot;
+    bool openerStateReceived = false;
     BatteryReport batteryReport;
     std::list<TimeControlEntry> listOfTimeControlEntries;
     std::list<LogEntry> listOfLogEntries;
 
     Config config;
     AdvancedConfig advancedConfig;
+    Nuki::SeqLock<Config> configCache;
+    Nuki::SeqLock<AdvancedConfig> advancedConfigCache;
+    std::atomic<uint32_t> configCachedAt{0};
+    std::atomic<uint32_t> advancedConfigCachedAt{0};
 
 };
 
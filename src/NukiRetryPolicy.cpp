@@ -0,0 +1,50 @@
+/**
+ * @file NukiRetryPolicy.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiRetryPolicy.h"
+
+namespace Nuki {
+
+uint32_t RetryPolicy::backoffMs(const uint8_t retry, const uint32_t initialMs) const {
+  uint32_t backoff = initialMs;
+  for (uint8_t i = 0; i < retry && backoff < maxBackoffMs; i++) {
+    backoff *= backoffMultiplier;
+  }
+  if (backoff > maxBackoffMs) {
+    backoff = maxBackoffMs;
+  }
+  uint32_t maxJitter = backoff * jitterPercent / 100;
+  if (maxJitter > 0) {
+    backoff -= random(0, maxJitter + 1);
+  }
+  return backoff;
+}
+
+bool isIdempotent(const Command command, const CommandType cmdType) {
+  if (cmdType == CommandType::CommandWithChallengeAndAccept) {
+    return false;
+  }
+  switch (command) {
+    case Command::AuthorizationDatInvite:
+    case Command::AuthorizationIdInvite:
+    case Command::AddTimeControlEntry:
+    case Command::AddKeypadCode:
+    case Command::RequestCalibration:
+    case Command::RequestReboot:
+    case Command::StartBusSignalRecording:
+      return false;
+    default:
+      return true;
+  }
+}
+
+} // namespace Nuki
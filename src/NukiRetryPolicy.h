@@ -0,0 +1,59 @@
+#pragma once
+/**
+ * @file NukiRetryPolicy.h
+ * Retry and backoff settings for commands and BLE connects
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include "NukiConstants.h"
+
+namespace Nuki {
+
+enum class RetryReason : uint8_t {
+  LockBusy        = 0,              //error report 69, the lock rejected the command
+  ConnectFailure  = 1,              //no BLE connection within the connect attempts
+  CrcFailure      = 2,              //the response was lost due to an invalid CRC or failed decryption
+  TimeOut         = 3               //no response within the response timeout
+};
+
+const uint8_t RETRY_REASON_COUNT = 4;
+
+/**
+ * @brief Retries of a failed command, decided per failure reason within a per call budget. Retries wait an
+ * exponential backoff (initialBackoffMs * backoffMultiplier^retry, max maxBackoffMs) reduced by a random jitter
+ * and never extend beyond the deadline of an active DeadlineScope.
+ *
+ * Commands that are not idempotent (lock actions, adding keypad codes or time control entries, ...) are only
+ * retried when they were not executed by the lock: failed before the command itself was sent, or rejected as busy
+ * before being accepted. A lost response to such a command is returned to the caller, never retried.
+ */
+struct RetryPolicy {
+  uint8_t maxRetries[RETRY_REASON_COUNT] = {3, 1, 1, 0}; //per RetryReason
+  uint8_t retryBudget = 3;          //max retries of one call over all reasons, 0 disables retries
+  uint32_t initialBackoffMs = 250;
+  uint32_t maxBackoffMs = 4000;
+  uint8_t backoffMultiplier = 2;
+  uint8_t jitterPercent = 50;       //the backoff is reduced by a random part of up to this percentage
+  uint8_t connectAttempts = 5;      //BLE connect attempts within one send
+  uint32_t connectBackoffMs = 10;   //pause after the first failed connect attempt, grows like the command backoff
+
+  /**
+   * @brief Backoff with jitter before retry number retry (0 = first retry) starting at initialMs
+   */
+  uint32_t backoffMs(const uint8_t retry, const uint32_t initialMs) const;
+};
+
+/**
+ * @brief True if executing command twice has the same effect as executing it once
+ */
+bool isIdempotent(const Command command, const CommandType cmdType);
+
+} // namespace Nuki
@@ -0,0 +1,158 @@
+#pragma once
+/**
+ * @file NukiRingBuffer.h
+ * Lock-free ring buffers with preallocated slots
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Nuki {
+
+/**
+ * @brief Fixed size ring of N preallocated slots of type T.
+ * Exactly one task may produce (acquireWrite/commitWrite) and exactly one task may consume
+ * (peekRead/releaseRead), no locks are taken and no memory is allocated after construction.
+ *
+ * @tparam T slot type
+ * @tparam N number of slots, must be a power of 2
+ */
+template <typename T, size_t N>
+class SpscRingBuffer {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRingBuffer size must be a power of 2");
+
+  public:
+    /**
+     * @brief Returns the next free slot to be filled by the producer or nullptr if the ring is full.
+     * The slot is only visible to the consumer after commitWrite()
+     */
+    T* acquireWrite() {
+      uint32_t head = writeIndex.load(std::memory_order_relaxed);
+      if (head - readIndex.load(std::memory_order_acquire) >= N) {
+        return nullptr;
+      }
+      return &slots[head & (N - 1)];
+    }
+
+    /**
+     * @brief Publishes the slot returned by the last acquireWrite() to the consumer
+     */
+    void commitWrite() {
+      writeIndex.store(writeIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Returns the oldest published slot or nullptr if the ring is empty
+     */
+    T* peekRead() {
+      uint32_t tail = readIndex.load(std::memory_order_relaxed);
+      if (tail == writeIndex.load(std::memory_order_acquire)) {
+        return nullptr;
+      }
+      return &slots[tail & (N - 1)];
+    }
+
+    /**
+     * @brief Hands the slot returned by the last peekRead() back to the producer
+     */
+    void releaseRead() {
+      readIndex.store(readIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Number of published slots not yet released by the consumer
+     */
+    size_t size() const {
+      return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+    }
+
+    constexpr size_t capacity() const {
+      return N;
+    }
+
+  private:
+    T slots[N];
+    std::atomic<uint32_t> writeIndex{0};
+    std::atomic<uint32_t> readIndex{0};
+};
+
+/**
+ * @brief Bounded lock-free queue of N elements of type T for multiple producers and a single consumer.
+ * push() never blocks, it fails when the queue is full so producers running in time critical tasks
+ * (BLE host, scanner) can drop instead of wait.
+ *
+ * @tparam T element type, copied in and out
+ * @tparam N number of elements, must be a power of 2
+ */
+template <typename T, size_t N>
+class MpscRingBuffer {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "MpscRingBuffer size must be a power of 2");
+
+  public:
+    MpscRingBuffer() {
+      for (uint32_t i = 0; i < N; i++) {
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    /**
+     * @brief Copies item into the queue, safe to call from any number of tasks
+     *
+     * @return false if the queue is full
+     */
+    bool push(const T& item) {
+      uint32_t pos = enqueueIndex.load(std::memory_order_relaxed);
+      while (1) {
+        Cell& cell = cells[pos & (N - 1)];
+        int32_t diff = (int32_t)(cell.sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+          if (enqueueIndex.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            cell.data = item;
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = enqueueIndex.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /**
+     * @brief Copies the oldest item out of the queue, only to be called from the consuming task
+     *
+     * @return false if the queue is empty
+     */
+    bool pop(T& item) {
+      Cell& cell = cells[dequeueIndex & (N - 1)];
+      if ((int32_t)(cell.sequence.load(std::memory_order_acquire) - (dequeueIndex + 1)) < 0) {
+        return false;
+      }
+      item = cell.data;
+      cell.sequence.store(dequeueIndex + N, std::memory_order_release);
+      dequeueIndex++;
+      return true;
+    }
+
+  private:
+    struct Cell {
+      std::atomic<uint32_t> sequence;
+      T data;
+    };
+
+    Cell cells[N];
+    std::atomic<uint32_t> enqueueIndex{0};
+    uint32_t dequeueIndex = 0;
+};
+
+} // namespace Nuki
@@ -0,0 +1,121 @@
+/**
+ * @file NukiSemaphoreProfiler.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiSemaphoreProfiler.h"
+
+namespace Nuki {
+
+const char* semaphoreTagName(const SemaphoreTag tag) {
+  switch (tag) {
+    case SemaphoreTag::Free:
+      return "free";
+    case SemaphoreTag::ExecAction:
+      return "exec Action";
+    case SemaphoreTag::RetrieveCredentials:
+      return "retr cred";
+    case SemaphoreTag::RetrievePincodeCredentials:
+      return "retr pincode cred";
+    case SemaphoreTag::DeleteCredentials:
+      return "del cred";
+    default:
+      return "unknown";
+  }
+}
+
+void SemaphoreProfiler::recordWait(const SemaphoreTag tag, const SemaphoreTag holder, const uint32_t waitUs, const bool acquired) {
+  portENTER_CRITICAL(&mux);
+  Entry& entry = entries[(uint8_t)tag];
+  if (acquired) {
+    entry.acquisitions++;
+  } else {
+    entry.timeouts++;
+  }
+  entry.totalWaitUs += waitUs;
+  if (waitUs > entry.maxWaitUs) {
+    entry.maxWaitUs = waitUs;
+  }
+  entry.wait.record(waitUs / 1000);
+
+  if (holder != SemaphoreTag::Free) {
+    Entry& blocking = entries[(uint8_t)holder];
+    blocking.blockingUs += waitUs;
+    if (!acquired) {
+      blocking.timeoutsCaused++;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+void SemaphoreProfiler::recordHold(const SemaphoreTag tag, const uint32_t holdUs) {
+  portENTER_CRITICAL(&mux);
+  Entry& entry = entries[(uint8_t)tag];
+  entry.totalHoldUs += holdUs;
+  if (holdUs > entry.maxHoldUs) {
+    entry.maxHoldUs = holdUs;
+  }
+  entry.hold.record(holdUs / 1000);
+  portEXIT_CRITICAL(&mux);
+}
+
+uint8_t SemaphoreProfiler::getStats(SemaphoreTagStats* stats, const uint8_t maxCount) const {
+  SemaphoreTagStats all[SEMAPHORE_TAG_COUNT];
+  uint8_t count = 0;
+
+  portENTER_CRITICAL(&mux);
+  for (uint8_t i = 1; i < SEMAPHORE_TAG_COUNT; i++) {
+    const Entry& entry = entries[i];
+    if (entry.acquisitions == 0 && entry.timeouts == 0 && entry.blockingUs == 0) {
+      continue;
+    }
+    SemaphoreTagStats& tagStats = all[count++];
+    tagStats.tag = (SemaphoreTag)i;
+    tagStats.acquisitions = entry.acquisitions;
+    tagStats.timeouts = entry.timeouts;
+    tagStats.totalWaitUs = entry.totalWaitUs;
+    tagStats.maxWaitUs = entry.maxWaitUs;
+    tagStats.totalHoldUs = entry.totalHoldUs;
+    tagStats.maxHoldUs = entry.maxHoldUs;
+    tagStats.blockingUs = entry.blockingUs;
+    tagStats.timeoutsCaused = entry.timeoutsCaused;
+    tagStats.wait = entry.wait.getPercentiles();
+    tagStats.hold = entry.hold.getPercentiles();
+  }
+  portEXIT_CRITICAL(&mux);
+
+  //insertion sort, worst offender first
+  for (uint8_t i = 1; i < count; i++) {
+    SemaphoreTagStats current = all[i];
+    int j = i - 1;
+    while (j >= 0 && (all[j].blockingUs < current.blockingUs
+                      || (all[j].blockingUs == current.blockingUs && all[j].totalHoldUs < current.totalHoldUs))) {
+      all[j + 1] = all[j];
+      j--;
+    }
+    all[j + 1] = current;
+  }
+
+  if (count > maxCount) {
+    count = maxCount;
+  }
+  memcpy(stats, all, count * sizeof(SemaphoreTagStats));
+  return count;
+}
+
+void SemaphoreProfiler::reset() {
+  portENTER_CRITICAL(&mux);
+  for (uint8_t i = 0; i < SEMAPHORE_TAG_COUNT; i++) {
+    entries[i] = Entry();
+  }
+  portEXIT_CRITICAL(&mux);
+}
+
+} // namespace Nuki
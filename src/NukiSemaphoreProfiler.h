@@ -0,0 +1,90 @@
+#pragma once
+/**
+ * @file NukiSemaphoreProfiler.h
+ * Wait and hold time profiling of the BLE semaphore per taker
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include "NukiDataTypes.h"
+#include "NukiCommandLatency.h"
+
+namespace Nuki {
+
+/**
+ * @brief Identifies the code path taking the BLE semaphore
+ */
+enum class SemaphoreTag : uint8_t {
+  Free                        = 0,
+  ExecAction                  = 1,
+  RetrieveCredentials         = 2,
+  RetrievePincodeCredentials  = 3,
+  DeleteCredentials           = 4
+};
+
+const uint8_t SEMAPHORE_TAG_COUNT = 5;
+
+const char* semaphoreTagName(const SemaphoreTag tag);
+
+struct SemaphoreTagStats {
+  SemaphoreTag tag;
+  uint32_t acquisitions;
+  uint32_t timeouts;
+  uint64_t totalWaitUs;
+  uint32_t maxWaitUs;
+  uint64_t totalHoldUs;
+  uint32_t maxHoldUs;
+  uint64_t blockingUs;              //wait time of other takers that started while this tag held the semaphore
+  uint32_t timeoutsCaused;          //timeouts of other takers that started while this tag held the semaphore
+  LatencyPercentiles wait;
+  LatencyPercentiles hold;
+};
+
+/**
+ * @brief Wait and hold time histograms and totals per SemaphoreTag, guarded by a short critical section
+ */
+class SemaphoreProfiler {
+  public:
+    /**
+     * @param tag taker
+     * @param holder owner of the semaphore when the wait started
+     */
+    void recordWait(const SemaphoreTag tag, const SemaphoreTag holder, const uint32_t waitUs, const bool acquired);
+    void recordHold(const SemaphoreTag tag, const uint32_t holdUs);
+
+    /**
+     * @brief Copies the stats of all tags that took or blocked the semaphore, worst offender first
+     * (most wait time caused for others, then longest total hold time)
+     *
+     * @return number of entries written to stats
+     */
+    uint8_t getStats(SemaphoreTagStats* stats, const uint8_t maxCount) const;
+
+    void reset();
+
+  private:
+    struct Entry {
+      uint32_t acquisitions = 0;
+      uint32_t timeouts = 0;
+      uint64_t totalWaitUs = 0;
+      uint32_t maxWaitUs = 0;
+      uint64_t totalHoldUs = 0;
+      uint32_t maxHoldUs = 0;
+      uint64_t blockingUs = 0;
+      uint32_t timeoutsCaused = 0;
+      LatencyHistogram wait;
+      LatencyHistogram hold;
+    };
+
+    Entry entries[SEMAPHORE_TAG_COUNT];
+    mutable portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+} // namespace Nuki
@@ -0,0 +1,84 @@
+#pragma once
+/**
+ * @file NukiSeqLock.h
+ * Sequence lock protecting a small value that is written rarely and read from multiple tasks
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "Arduino.h"
+#include <atomic>
+
+namespace Nuki {
+
+/**
+ * @brief Readers never block and never take a lock, they copy the value and retry in the (rare) case
+ * a write happened during the copy. Writers are serialized by a short critical section so a writer
+ * can not be preempted halfway by a reader spinning on the same core.
+ *
+ * @tparam T trivially copyable value type
+ */
+template <typename T>
+class SeqLock {
+  public:
+    /**
+     * @brief Returns a consistent copy of the value
+     */
+    T read() const {
+      T result;
+      uint32_t before;
+      uint32_t after;
+      do {
+        before = sequence.load(std::memory_order_acquire);
+        memcpy((void*)&result, (const void*)&value, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = sequence.load(std::memory_order_relaxed);
+      } while ((before & 1) || before != after);
+      return result;
+    }
+
+    /**
+     * @brief Replaces the value
+     */
+    void write(const T& newValue) {
+      portENTER_CRITICAL(&writeMux);
+      beginWrite();
+      memcpy((void*)&value, (const void*)&newValue, sizeof(T));
+      endWrite();
+      portEXIT_CRITICAL(&writeMux);
+    }
+
+    /**
+     * @brief Modifies the value in place, modifier must be short and must not block
+     */
+    template <typename TModifier>
+    void update(TModifier modifier) {
+      portENTER_CRITICAL(&writeMux);
+      beginWrite();
+      modifier(value);
+      endWrite();
+      portEXIT_CRITICAL(&writeMux);
+    }
+
+  private:
+    void beginWrite() {
+      sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endWrite() {
+      sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    T value{};
+    std::atomic<uint32_t> sequence{0};
+    portMUX_TYPE writeMux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+} // namespace Nuki
@@ -0,0 +1,159 @@
+/**
+ * @file NukiTraceReplayer.cpp
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiTraceReplayer.h"
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_GLOBAL_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+#define PCAP_PSEUDO_HEADER_SIZE 4
+
+namespace Nuki {
+
+TraceReplayer::TraceReplayer(NukiBle* device)
+  : device(device) {
+}
+
+bool TraceReplayer::load(const uint8_t* data, const size_t length) {
+  frames.clear();
+  uint32_t magic = 0;
+  if (length < PCAP_GLOBAL_HEADER_SIZE) {
+    return false;
+  }
+  memcpy(&magic, data, sizeof(magic));
+  if (magic != PCAP_MAGIC) {
+    log_w("Trace is not a pcap file written by exportFrameTrace()");
+    return false;
+  }
+
+  size_t offset = PCAP_GLOBAL_HEADER_SIZE;
+  while (offset + PCAP_RECORD_HEADER_SIZE <= length) {
+    uint32_t header[4];
+    memcpy(header, &data[offset], sizeof(header));
+    uint32_t inclLen = header[2];
+    uint32_t origLen = header[3];
+    offset += PCAP_RECORD_HEADER_SIZE;
+    if (inclLen < PCAP_PSEUDO_HEADER_SIZE || offset + inclLen > length
+        || inclLen - PCAP_PSEUDO_HEADER_SIZE > NUKI_TRACE_FRAME_SIZE) {
+      log_w("Corrupt trace record at offset %d", offset);
+      frames.clear();
+      return false;
+    }
+
+    TraceFrame frame;
+    frame.timestampUs = (int64_t)header[0] * 1000000 + header[1];
+    frame.direction = (FrameDirection)data[offset];
+    frame.characteristic = (NotificationSource)data[offset + 1];
+    frame.length = inclLen - PCAP_PSEUDO_HEADER_SIZE;
+    frame.originalLength = origLen - PCAP_PSEUDO_HEADER_SIZE;
+    memcpy(frame.data, &data[offset + PCAP_PSEUDO_HEADER_SIZE], frame.length);
+    frames.push_back(frame);
+    offset += inclLen;
+  }
+  return true;
+}
+
+size_t TraceReplayer::getFrameCount() const {
+  return frames.size();
+}
+
+uint16_t TraceReplayer::commandIdentifier(const NotificationSource characteristic, const uint8_t* plaintext, const uint16_t length) {
+  uint8_t offset = characteristic == NotificationSource::Usdio ? 4 : 0;
+  uint16_t command = 0;
+  if (length >= offset + 2) {
+    memcpy(&command, &plaintext[offset], 2);
+  }
+  return command;
+}
+
+bool TraceReplayer::onSendMessage(const NotificationSource characteristic, const uint8_t* plaintext, const uint16_t length) {
+  OutboundMessage* message = outbound.acquireWrite();
+  if (message != nullptr) {
+    message->characteristic = characteristic;
+    message->command = commandIdentifier(characteristic, plaintext, length);
+    outbound.commitWrite();
+  }
+  return true;
+}
+
+void TraceReplayer::checkOutbound(const TraceFrame& frame, const ReplayOptions& options, ReplayStats& stats) {
+  Clock* clock = device->getClock();
+  uint32_t start = clock->nowMs();
+  OutboundMessage* message;
+  while ((message = outbound.peekRead()) == nullptr) {
+    if (clock->nowMs() - start > options.outboundTimeoutMs) {
+      stats.outboundMissing++;
+      return;
+    }
+    clock->sleepMs(1);
+  }
+
+  if (message->characteristic == frame.characteristic
+      && message->command == commandIdentifier(frame.characteristic, frame.data, frame.length)) {
+    stats.outboundMatched++;
+  } else {
+    log_w("Replay: sent command %04x, trace has %04x", message->command, commandIdentifier(frame.characteristic, frame.data, frame.length));
+    stats.outboundMismatched++;
+  }
+  outbound.releaseRead();
+}
+
+ReplayStats TraceReplayer::replay(const ReplayOptions& options) {
+  ReplayStats stats = {};
+  if (frames.empty()) {
+    return stats;
+  }
+
+  //drop messages left over from an earlier replay
+  while (outbound.peekRead() != nullptr) {
+    outbound.releaseRead();
+  }
+
+  device->setMessageTap(this);
+  device->injectAdvertisement(-50);
+
+  Clock* clock = device->getClock();
+  uint32_t replayStart = clock->nowMs();
+  int64_t traceStartUs = frames.front().timestampUs;
+  for (const TraceFrame& frame : frames) {
+    uint32_t dueMs = (uint32_t)((frame.timestampUs - traceStartUs) / 1000 * options.timeScale);
+    while (clock->nowMs() - replayStart < dueMs) {
+      clock->sleepMs(1);
+    }
+
+    if (frame.direction == FrameDirection::Tx) {
+      if (options.checkOutbound) {
+        checkOutbound(frame, options, stats);
+      }
+      continue;
+    }
+
+    uint32_t processingUs = 0;
+    bool accepted = device->injectReceivedMessage(frame.characteristic, frame.data, frame.length, &processingUs);
+
+    stats.totalProcessingUs += processingUs;
+    if (processingUs > stats.maxProcessingUs) {
+      stats.maxProcessingUs = processingUs;
+    }
+    if (accepted) {
+      stats.injected++;
+    } else {
+      stats.rejected++;
+    }
+  }
+
+  device->setMessageTap(nullptr);
+  stats.durationMs = clock->nowMs() - replayStart;
+  return stats;
+}
+
+} // namespace Nuki
@@ -0,0 +1,86 @@
+#pragma once
+/**
+ * @file NukiTraceReplayer.h
+ * Replays recorded frame traces into a NukiLock / NukiOpener
+ *
+ * Created: 2022
+ * License: GNU GENERAL PUBLIC LICENSE (see LICENSE)
+ *
+ * This library implements the communication from an ESP32 via BLE to a Nuki smart lock.
+ * Based on the Nuki Smart Lock API V2.2.1
+ * https://developer.nuki.io/page/nuki-smart-lock-api-2/2/
+ *
+ */
+
+#include "NukiBle.h"
+#include "NukiFrameRecorder.h"
+#include "NukiRingBuffer.h"
+#include <vector>
+
+#ifndef NUKI_REPLAY_OUTBOUND_QUEUE_SIZE
+#define NUKI_REPLAY_OUTBOUND_QUEUE_SIZE 8
+#endif
+
+namespace Nuki {
+
+struct ReplayOptions {
+  float timeScale = 1.0;            //1.0 = original timing, 0.5 = twice as fast, 0 = no waiting at all
+  bool checkOutbound = false;       //wait for and compare the messages sent by the device with the recorded tx frames
+  uint32_t outboundTimeoutMs = GENERAL_TIMEOUT;
+};
+
+struct ReplayStats {
+  uint32_t injected;                //rx messages fed into the device
+  uint32_t rejected;                //rx messages with invalid length or CRC
+  uint64_t totalProcessingUs;       //time the notification task spent handling the injected messages
+  uint32_t maxProcessingUs;
+  uint32_t outboundMatched;         //tx frames matched by a sent message with the same command identifier
+  uint32_t outboundMismatched;
+  uint32_t outboundMissing;         //tx frames for which no message was sent within outboundTimeoutMs
+  uint32_t durationMs;
+};
+
+/**
+ * @brief Feeds the received messages of a trace exported with NukiBle::exportFrameTrace() into a device
+ * with original or scaled timing and measures the processing time per message.
+ *
+ * During replay the replayer is installed as message tap, messages sent by the device are consumed (nothing is sent
+ * over BLE) and, with checkOutbound, compared with the recorded tx frames. To reproduce a complete command exchange
+ * the command (e.g. requestKeyTurnerState()) is issued from another task while replay() runs, the device needs to
+ * be paired (stored credentials) for commands to be executed.
+ */
+class TraceReplayer : public MessageTap {
+  public:
+    explicit TraceReplayer(NukiBle* device);
+
+    /**
+     * @brief Parses a pcap trace as written by NukiBle::exportFrameTrace()
+     *
+     * @return false if data is not a valid trace
+     */
+    bool load(const uint8_t* data, const size_t length);
+
+    size_t getFrameCount() const;
+
+    /**
+     * @brief Replays all loaded frames, blocks until done
+     */
+    ReplayStats replay(const ReplayOptions& options = ReplayOptions());
+
+    bool onSendMessage(const NotificationSource characteristic, const uint8_t* plaintext, const uint16_t length) override;
+
+  private:
+    struct OutboundMessage {
+      NotificationSource characteristic;
+      uint16_t command;
+    };
+
+    static uint16_t commandIdentifier(const NotificationSource characteristic, const uint8_t* plaintext, const uint16_t length);
+    void checkOutbound(const TraceFrame& frame, const ReplayOptions& options, ReplayStats& stats);
+
+    NukiBle* device;
+    std::vector<TraceFrame> frames;
+    SpscRingBuffer<OutboundMessage, NUKI_REPLAY_OUTBOUND_QUEUE_SIZE> outbound;
+};
+
+} // namespace Nuki